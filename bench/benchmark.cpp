@@ -0,0 +1,222 @@
+// Native benchmark of the Louvain pipeline on synthetic graphs, without
+// the Python bindings. Build from the repository root with
+//
+//   g++ -std=c++17 -Ofast -pthread -o benchmark bench/benchmark.cpp
+//       bench/generators.cpp src/algorithm.cpp src/checkpoint.cpp
+//       src/parallel.cpp src/progress.cpp src/reorder.cpp
+//
+// and run e.g. `./benchmark rmat 10000000 --threads 8`. Every run prints
+// one JSON line so results can be appended to a file and compared.
+#include <sys/resource.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include "generators.hpp"
+#include "../src/reorder.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct Options
+{
+    std::string generator;
+    size_t n_edges = 0;
+    int n_threads = 1;
+    bool prune = false;
+    uint64_t seed = 42;
+    float resolution = 1;
+    double avg_degree = 16;
+    double mu = 0.3;
+    std::string order = "none";
+};
+
+struct Timings
+{
+    double generate = 0;
+    double build = 0;
+    double reorder = 0;
+    double init_status = 0;
+    double one_level = 0;
+    double renumber = 0;
+    double induced_graph = 0;
+    size_t levels = 0;
+    size_t n_nodes = 0;
+    size_t n_edges = 0;
+    double modularity = 0;
+};
+
+[[noreturn]] void usage()
+{
+    std::fprintf(stderr,
+                 "usage: benchmark <rmat|sbm|lfr> <n_edges> [--threads N] "
+                 "[--prune] [--seed S] [--resolution R] [--degree D] [--mu MU] "
+                 "[--order none|degree|rcm|random]\n");
+    std::exit(2);
+}
+
+Options parse_options(int argc, char **argv)
+{
+    if (argc < 3)
+        usage();
+    Options options;
+    options.generator = argv[1];
+    options.n_edges = std::stoull(argv[2]);
+    for (int i = 3; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--prune")
+            options.prune = true;
+        else if (arg == "--threads" && has_value)
+            options.n_threads = std::stoi(argv[++i]);
+        else if (arg == "--seed" && has_value)
+            options.seed = std::stoull(argv[++i]);
+        else if (arg == "--resolution" && has_value)
+            options.resolution = std::stof(argv[++i]);
+        else if (arg == "--degree" && has_value)
+            options.avg_degree = std::stod(argv[++i]);
+        else if (arg == "--mu" && has_value)
+            options.mu = std::stod(argv[++i]);
+        else if (arg == "--order" && has_value)
+            options.order = argv[++i];
+        else
+            usage();
+    }
+    return options;
+}
+
+// Edge list of about options.n_edges undirected edges
+Edges generate(Options const &options, size_t &n_nodes)
+{
+    size_t edges_per_node = std::max<size_t>(1, options.avg_degree / 2);
+    n_nodes = std::max<size_t>(2, options.n_edges / edges_per_node);
+
+    if (options.generator == "rmat")
+    {
+        int scale = 1;
+        while ((size_t(1) << scale) < n_nodes)
+            scale++;
+        n_nodes = size_t(1) << scale;
+        size_t edge_factor = std::max<size_t>(1, options.n_edges >> scale);
+        return generate_rmat(scale, edge_factor, 0.57, 0.19, 0.19, options.seed);
+    }
+    if (options.generator == "sbm")
+    {
+        size_t n_blocks = std::max<size_t>(1, n_nodes / 1000);
+        return generate_sbm(n_nodes, n_blocks, options.avg_degree,
+                            options.mu, options.seed);
+    }
+    if (options.generator == "lfr")
+    {
+        size_t max_degree = std::min<size_t>(n_nodes - 1, 50 * options.avg_degree);
+        size_t max_community = std::min<size_t>(n_nodes, 5000);
+        return generate_lfr(n_nodes, options.avg_degree, max_degree,
+                            2.5, 1.5, 20, max_community,
+                            options.mu, options.seed);
+    }
+    usage();
+}
+
+// Same level loop as dendrogram(), with every phase timed on its own
+template <typename Index>
+void run(Options const &options, size_t n_nodes, Edges const &edges, Timings &timings)
+{
+    auto start = Clock::now();
+    CSRGraph<Index> graph = build_csr<Index>(n_nodes, edges);
+    timings.build = seconds_since(start);
+    timings.n_nodes = graph.n_nodes;
+    timings.n_edges = graph.n_edges() / 2;
+
+    ThreadPool pool(resolve_n_threads(options.n_threads));
+    if (options.order != "none")
+    {
+        start = Clock::now();
+        graph = permute_graph(graph, node_order(graph, options.order, options.seed), pool);
+        timings.reorder = seconds_since(start);
+    }
+    Nodes node2com;
+    Weights internals;
+    Weights loops;
+    Weights degrees;
+    Weights gdegrees;
+    Communities communities;
+    AggregateBuffers<Index> buffers;
+    double mod = std::numeric_limits<double>::lowest();
+    while (true)
+    {
+        start = Clock::now();
+        float total_weight = init_status(
+            graph, node2com, internals, loops, degrees, gdegrees);
+        timings.init_status += seconds_since(start);
+
+        start = Clock::now();
+        move_nodes(graph,
+                   node2com, internals, loops, degrees, gdegrees,
+                   total_weight, options.resolution, options.prune, pool);
+        timings.one_level += seconds_since(start);
+
+        double new_mod = modularity(internals, degrees, total_weight, options.resolution);
+        if (timings.levels > 0 && new_mod - mod < 0.0000001)
+            break;
+        mod = new_mod;
+        timings.levels++;
+
+        start = Clock::now();
+        renumber(node2com, communities, node2com);
+        timings.renumber += seconds_since(start);
+
+        start = Clock::now();
+        graph = induced_graph(graph, communities, node2com, pool, buffers);
+        timings.induced_graph += seconds_since(start);
+    }
+    timings.modularity = mod;
+}
+
+long peak_rss_kb()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+int main(int argc, char **argv)
+{
+    Options options = parse_options(argc, argv);
+    Timings timings;
+
+    size_t n_nodes;
+    auto start = Clock::now();
+    Edges edges = generate(options, n_nodes);
+    timings.generate = seconds_since(start);
+
+    // int32 indices as long as the directed edge count fits
+    if (2 * edges.size() < size_t(std::numeric_limits<int32_t>::max()))
+        run<int32_t>(options, n_nodes, edges, timings);
+    else
+        run<int64_t>(options, n_nodes, edges, timings);
+
+    double louvain = timings.init_status + timings.one_level +
+                     timings.renumber + timings.induced_graph;
+    std::printf(
+        "{\"generator\": \"%s\", \"n_nodes\": %zu, \"n_edges\": %zu, "
+        "\"threads\": %zu, \"prune\": %s, \"seed\": %llu, \"order\": \"%s\", "
+        "\"generate_s\": %.4f, \"build_s\": %.4f, \"reorder_s\": %.4f, "
+        "\"init_status_s\": %.4f, "
+        "\"one_level_s\": %.4f, \"renumber_s\": %.4f, \"induced_graph_s\": %.4f, "
+        "\"louvain_s\": %.4f, \"edges_per_s\": %.0f, \"levels\": %zu, "
+        "\"modularity\": %.6f, \"peak_rss_kb\": %ld}\n",
+        options.generator.c_str(), timings.n_nodes, timings.n_edges,
+        resolve_n_threads(options.n_threads), options.prune ? "true" : "false",
+        (unsigned long long)options.seed, options.order.c_str(),
+        timings.generate, timings.build, timings.reorder, timings.init_status,
+        timings.one_level, timings.renumber, timings.induced_graph,
+        louvain, timings.n_edges / louvain, timings.levels,
+        timings.modularity, peak_rss_kb());
+    return 0;
+}
@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include "generators.hpp"
+
+Edges generate_rmat(
+    int scale,
+    size_t edge_factor,
+    double a,
+    double b,
+    double c,
+    uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    size_t n_edges = edge_factor << scale;
+
+    Edges edges;
+    edges.reserve(n_edges);
+    while (edges.size() < n_edges)
+    {
+        Node u = 0;
+        Node v = 0;
+        for (int bit = 0; bit < scale; bit++)
+        {
+            double r = uniform(rng);
+            if (r < a)
+                continue;
+            else if (r < a + b)
+                v |= Node(1) << bit;
+            else if (r < a + b + c)
+                u |= Node(1) << bit;
+            else
+            {
+                u |= Node(1) << bit;
+                v |= Node(1) << bit;
+            }
+        }
+        if (u != v)
+            edges.emplace_back(u, v);
+    }
+    return edges;
+}
+
+Edges generate_sbm(
+    size_t n_nodes,
+    size_t n_blocks,
+    double avg_degree,
+    double mu,
+    uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::uniform_int_distribution<Node> any_node(0, n_nodes - 1);
+    size_t block_size = (n_nodes + n_blocks - 1) / n_blocks;
+    size_t edges_per_node = std::max<size_t>(1, std::lround(avg_degree / 2));
+
+    Edges edges;
+    edges.reserve(n_nodes * edges_per_node);
+    for (Node u = 0; u < n_nodes; u++)
+    {
+        Node block_start = u / block_size * block_size;
+        Node block_stop = std::min<Node>(block_start + block_size, n_nodes);
+        std::uniform_int_distribution<Node> same_block(block_start, block_stop - 1);
+        for (size_t k = 0; k < edges_per_node; k++)
+        {
+            Node v = uniform(rng) < mu ? any_node(rng) : same_block(rng);
+            if (u != v)
+                edges.emplace_back(u, v);
+        }
+    }
+    return edges;
+}
+
+// Integers of [low, high] drawn from a power law of the given exponent
+std::vector<size_t> power_law_sequence(
+    size_t n,
+    double exponent,
+    double low,
+    double high,
+    std::mt19937_64 &rng)
+{
+    std::uniform_real_distribution<double> uniform(0, 1);
+    double e = 1 - exponent;
+    double low_e = std::pow(low, e);
+    double high_e = std::pow(high, e);
+    std::vector<size_t> values(n);
+    for (size_t &value : values)
+        value = std::lround(std::pow(low_e + (high_e - low_e) * uniform(rng), 1 / e));
+    return values;
+}
+
+// Mean of the power law on [low, high], used to pick `low` from the
+// requested average degree
+double power_law_mean(double exponent, double low, double high)
+{
+    double e1 = 1 - exponent;
+    double e2 = 2 - exponent;
+    return e1 / e2 * (std::pow(high, e2) - std::pow(low, e2)) /
+           (std::pow(high, e1) - std::pow(low, e1));
+}
+
+void pair_stubs(Nodes &stubs, std::mt19937_64 &rng, Edges &edges)
+{
+    std::shuffle(stubs.begin(), stubs.end(), rng);
+    for (size_t k = 0; k + 1 < stubs.size(); k += 2)
+    {
+        if (stubs[k] != stubs[k + 1])
+            edges.emplace_back(stubs[k], stubs[k + 1]);
+    }
+}
+
+Edges generate_lfr(
+    size_t n_nodes,
+    double avg_degree,
+    size_t max_degree,
+    double tau1,
+    double tau2,
+    size_t min_community,
+    size_t max_community,
+    double mu,
+    uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+
+    // degrees
+    double low = 1;
+    double high = max_degree;
+    for (int iteration = 0; iteration < 50; iteration++)
+    {
+        double mid = (low + high) / 2;
+        if (power_law_mean(tau1, mid, max_degree) < avg_degree)
+            low = mid;
+        else
+            high = mid;
+    }
+    std::vector<size_t> degrees = power_law_sequence(
+        n_nodes, tau1, low, max_degree, rng);
+
+    // communities
+    Nodes nodes(n_nodes);
+    for (Node node = 0; node < n_nodes; node++)
+        nodes[node] = node;
+    std::shuffle(nodes.begin(), nodes.end(), rng);
+
+    Edges edges;
+    edges.reserve(n_nodes * avg_degree / 2);
+    Nodes external;
+    size_t assigned = 0;
+    while (assigned < n_nodes)
+    {
+        size_t size = power_law_sequence(
+            1, tau2, min_community, max_community, rng)[0];
+        size = std::min(size, n_nodes - assigned);
+
+        Nodes internal;
+        for (size_t k = assigned; k < assigned + size; k++)
+        {
+            Node node = nodes[k];
+            size_t degree = degrees[node];
+            size_t n_internal = std::lround((1 - mu) * degree);
+            n_internal = std::min(n_internal, size - 1);
+            internal.insert(internal.end(), n_internal, node);
+            external.insert(external.end(), degree - n_internal, node);
+        }
+        pair_stubs(internal, rng, edges);
+        assigned += size;
+    }
+    pair_stubs(external, rng, edges);
+    return edges;
+}
+
+template <typename Index>
+CSRGraph<Index> build_csr(size_t n_nodes, Edges const &edges)
+{
+    Edges directed;
+    directed.reserve(2 * edges.size());
+    for (auto [u, v] : edges)
+    {
+        directed.emplace_back(u, v);
+        directed.emplace_back(v, u);
+    }
+    std::sort(directed.begin(), directed.end());
+    directed.erase(std::unique(directed.begin(), directed.end()), directed.end());
+
+    std::vector<Index> indptr(n_nodes + 1, 0);
+    std::vector<Index> indices(directed.size());
+    Weights weights(directed.size(), 1);
+    for (size_t k = 0; k < directed.size(); k++)
+    {
+        indptr[directed[k].first + 1]++;
+        indices[k] = directed[k].second;
+    }
+    for (size_t node = 0; node < n_nodes; node++)
+        indptr[node + 1] += indptr[node];
+    return make_csr(std::move(indptr), std::move(indices), std::move(weights));
+}
+
+template CSRGraph<int32_t> build_csr(size_t, Edges const &);
+template CSRGraph<int64_t> build_csr(size_t, Edges const &);
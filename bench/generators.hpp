@@ -0,0 +1,46 @@
+#pragma once
+#include <utility>
+#include "../src/algorithm.hpp"
+
+using Edge = std::pair<Node, Node>;
+using Edges = std::vector<Edge>;
+
+// Undirected edge lists, each edge listed once and without self-loops.
+// Duplicates are possible and are merged by build_csr.
+
+// R-MAT graph with 2^scale nodes and edge_factor * 2^scale edges
+Edges generate_rmat(
+    int scale,
+    size_t edge_factor,
+    double a,
+    double b,
+    double c,
+    uint64_t seed);
+
+// Planted partition: n_nodes split into n_blocks equal blocks, each node
+// drawing avg_degree / 2 edges that leave its block with probability mu
+Edges generate_sbm(
+    size_t n_nodes,
+    size_t n_blocks,
+    double avg_degree,
+    double mu,
+    uint64_t seed);
+
+// LFR benchmark graph: power-law degrees (exponent tau1) and community
+// sizes (exponent tau2), a fraction mu of every node's edges leaving its
+// community. Stubs are paired at random inside each community and across
+// the whole graph, as in the configuration model.
+Edges generate_lfr(
+    size_t n_nodes,
+    double avg_degree,
+    size_t max_degree,
+    double tau1,
+    double tau2,
+    size_t min_community,
+    size_t max_community,
+    double mu,
+    uint64_t seed);
+
+// Symmetric CSR with unit weights, duplicate edges merged
+template <typename Index>
+CSRGraph<Index> build_csr(size_t n_nodes, Edges const &edges);
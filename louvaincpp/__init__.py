@@ -1 +1,4 @@
-from .algorithm import louvain, metric_louvain
+from .algorithm import (convert_edgelist, edges_to_csr, louvain,
+                        louvain_batch, louvain_consensus, louvain_distributed,
+                        louvain_edges, louvain_file, louvain_multi,
+                        metric_louvain, update_louvain)
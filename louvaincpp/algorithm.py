@@ -1,62 +1,276 @@
+import multiprocessing
+import os
+import shutil
+import tempfile
+
 import networkx as nx
 import numpy as np
-from _louvaincpp import generate_dendrogram, generate_full_dendrogram
+from _louvaincpp import (convert_edgelist, edges_to_csr, generate_consensus,
+                         generate_dendrogram,
+                         generate_dendrogram_distributed,
+                         generate_dendrogram_file, generate_full_dendrogram,
+                         generate_multi_resolution, generate_partitions,
+                         partition_at_level, score_dendrogram,
+                         update_dendrogram)
 
 
 def generate_partition(dendrogram, level):
-    partition = range(len(dendrogram[-level]))
-    for i in range(level, len(dendrogram) + 1):
-        new_partition = dict()
-        for j in range(len(dendrogram[-i])):
-            new_partition[j] = partition[dendrogram[-i][j]]
-        partition = new_partition
-    return partition
+    return dict(enumerate(partition_at_level(dendrogram, level).tolist()))
 
 
 def partition_to_vec(partition):
+    if isinstance(partition, np.ndarray):
+        return partition
     y = np.zeros(len(partition), dtype=int)
-    for i, val in partition.items():
-        y[i] = val
+    y[np.fromiter(partition.keys(), dtype=int, count=len(partition))] = \
+        np.fromiter(partition.values(), dtype=int, count=len(partition))
     return y
 
 
-def louvain(G, resolution=1, prune=False, **_):
-    A = nx.adjacency_matrix(G)
+def csr_arrays(A):
+    # (indptr, indices, data) of a scipy sparse matrix, which must be a
+    # symmetric adjacency: duplicate entries are summed and explicit zeros
+    # dropped, on a copy. data is passed as None when every edge weighs 1,
+    # which runs without a weights array; float64 weights are read in
+    # place rather than copied to float32, but the sums of weights per node
+    # and community are still kept in float32.
+    A = A.tocsr(copy=True)
+    A.sum_duplicates()
+    A.eliminate_zeros()
+    if A.shape[0] != A.shape[1] or (A != A.T).nnz:
+        raise ValueError(
+            "the adjacency matrix must be symmetric; use louvain_edges for "
+            "an edge list")
+    data = None if np.all(A.data == 1) else A.data
+    return A.indptr, A.indices, data
+
+
+def graph_arrays(G):
+    # (indptr, indices, data) of G: an undirected networkx graph, a scipy
+    # sparse matrix (see csr_arrays), or such a tuple, e.g. from
+    # edges_to_csr, passed as is
+    if isinstance(G, tuple):
+        return G
+    if isinstance(G, nx.Graph):
+        G = nx.adjacency_matrix(G)
+    return csr_arrays(G)
+
+
+def initial_membership(partition, n_nodes):
+    # communities of `partition` (a dict or sequence indexed by node
+    # position, e.g. an earlier result of louvain) relabeled to 0..k-1
+    if isinstance(partition, np.ndarray):
+        labels = partition[:n_nodes]
+    else:
+        labels = np.array([partition[i] for i in range(n_nodes)])
+    return np.unique(labels, return_inverse=True)[1].astype(np.int64)
+
+
+def louvain(
+    G, resolution=1, prune=False, n_threads=1, method="louvain",
+    initial_partition=None, progress=None, return_stats=False,
+    as_array=False, order="none", seed=0, checkpoint=None, **_
+):
+    # progress(level, stats) is called after every sweep and level and can
+    # return False to stop early. With return_stats, the per-level
+    # LevelStats are returned along with the partition. With as_array,
+    # the partition is a numpy array indexed by node position instead of
+    # a dict. order ("degree" or "rcm") relabels the nodes for memory
+    # locality before clustering, and "random" shuffles them with `seed`;
+    # the result uses the original ids. G is anything graph_arrays takes.
+    # n_threads = 1 moves nodes one at a time and any larger count (0 for
+    # one per core) in batches, which finds another partition; the result
+    # is the same for every count above 1, whatever the number of cores.
+    # With a checkpoint path, the run is saved there after every level and
+    # resumes from it if restarted with the same graph and settings; the
+    # file is deleted once the run completes.
+    arrays = graph_arrays(G)
+
+    membership = None
+    if initial_partition is not None:
+        membership = initial_membership(initial_partition, len(arrays[0]) - 1)
 
     dendrogram = generate_dendrogram(
-        A.indptr, A.indices, A.data, resolution, prune)
-
-    partition = range(len(dendrogram[-1]))
-    for i in range(1, len(dendrogram) + 1):
-        new_partition = dict()
-        for j in range(len(dendrogram[-i])):
-            new_partition[j] = partition[dendrogram[-i][j]]
-        partition = new_partition
+        *arrays, resolution, prune, n_threads, method,
+        membership, progress, return_stats, order, seed, checkpoint or "")
+    if return_stats:
+        dendrogram, stats = dendrogram
+
+    partition = partition_at_level(dendrogram, 1)
+    if not as_array:
+        partition = dict(enumerate(partition.tolist()))
+    if return_stats:
+        return partition, stats
     return partition
 
 
-def metric_louvain(
-    G, X=None, resolution=1, prune=False, **_
+def louvain_edges(
+    sources, targets, weights=None, n_nodes=None, n_threads=1,
+    as_array=True, **kwargs
+):
+    # clusters the undirected graph with an edge from sources[i] to
+    # targets[i] (integer node ids) weighing weights[i], or 1, without
+    # going through networkx. Edges listed several times are summed. The
+    # graph has n_nodes nodes, by default the largest id + 1, and the
+    # partition is an array indexed by node id unless as_array is False.
+    arrays = edges_to_csr(sources, targets, weights, n_nodes, n_threads)
+    return louvain(arrays, n_threads=n_threads, as_array=as_array, **kwargs)
+
+
+def louvain_file(
+    path, resolution=1, prune=False, n_threads=1, method="louvain",
+    progress=None, return_stats=False, order="none", seed=0, checkpoint=None,
+    **_
 ):
-    from sklearn.metrics import silhouette_score as scoring
+    # clusters a graph file written by convert_edgelist without loading it
+    # into Python; the partition is a numpy array indexed by node id.
+    # checkpoint is as in louvain().
+    dendrogram = generate_dendrogram_file(
+        path, resolution, prune, n_threads, method, progress, return_stats,
+        order, seed, checkpoint or "")
+    if return_stats:
+        dendrogram, stats = dendrogram
+        return partition_at_level(dendrogram, 1), stats
+    return partition_at_level(dendrogram, 1)
+
+
+def louvain_distributed(
+    path, n_processes=2, resolution=1, prune=False, n_threads=1,
+    address=None, progress=None, return_stats=False, **_
+):
+    # clusters a graph file written by convert_edgelist with n_processes
+    # processes forked on this host, each reading only its share of the
+    # rows. Only the edges are split: every process holds O(n_nodes)
+    # memory whatever n_processes, so the graph must have few enough nodes
+    # for one process to hold a value per node. The first level is
+    # computed by all of them, the next ones by this process, which is
+    # also the only one calling progress. The processes talk over a Unix
+    # socket at `address` (a temporary path by default) or over TCP for
+    # "tcp://host:port". To spread the ranks over several hosts, call
+    # generate_dendrogram_distributed on each of them with a tcp://
+    # address.
+    directory = None
+    if address is None:
+        directory = tempfile.mkdtemp()
+        address = os.path.join(directory, "louvain.sock")
+
+    context = multiprocessing.get_context("fork")
+    workers = [
+        context.Process(
+            target=generate_dendrogram_distributed,
+            args=(path, rank, n_processes, address, resolution, prune,
+                  n_threads))
+        for rank in range(1, n_processes)]
+    for worker in workers:
+        worker.start()
+    try:
+        dendrogram = generate_dendrogram_distributed(
+            path, 0, n_processes, address, resolution, prune, n_threads,
+            progress, return_stats)
+    except BaseException:
+        for worker in workers:
+            worker.terminate()
+        raise
+    finally:
+        for worker in workers:
+            worker.join()
+        if directory is not None:
+            shutil.rmtree(directory, ignore_errors=True)
 
-    # from sklearn.metrics import calinski_harabasz_score as scoring
+    if return_stats:
+        dendrogram, stats = dendrogram
+        return partition_at_level(dendrogram, 1), stats
+    return partition_at_level(dendrogram, 1)
 
+
+def louvain_consensus(
+    G, n_runs=10, seed=0, resolution=1, prune=False, n_threads=0,
+    method="louvain", progress=None, return_stats=False, as_array=False, **_
+):
+    # consensus of n_runs runs in random node orders, seeded from seed to
+    # seed + n_runs - 1 and spread over n_threads threads (0 for one per
+    # core): G is clustered again with every edge weighing the fraction of
+    # the runs that put its ends together. progress only follows that last
+    # run. The partition is in the format of louvain().
+    dendrogram = generate_consensus(
+        *graph_arrays(G), n_runs, seed, resolution, prune, n_threads, method,
+        progress, return_stats)
+    if return_stats:
+        dendrogram, stats = dendrogram
+
+    partition = partition_at_level(dendrogram, 1)
+    if not as_array:
+        partition = dict(enumerate(partition.tolist()))
+    if return_stats:
+        return partition, stats
+    return partition
+
+
+def louvain_batch(
+    graphs, resolution=1, prune=False, n_threads=0, method="louvain",
+    as_array=False, **_
+):
+    # clusters many graphs (anything graph_arrays takes) in one call,
+    # spread over n_threads threads (0 for one per core), and returns one
+    # partition per graph in the format of louvain()
+    arrays = [graph_arrays(G) for G in graphs]
+
+    partitions = generate_partitions(
+        arrays, resolution, prune, n_threads, method)
+    if as_array:
+        return partitions
+    return [dict(enumerate(partition.tolist())) for partition in partitions]
+
+
+def louvain_multi(
+    G, resolutions, prune=False, n_threads=0, method="louvain", **_
+):
+    # clusters G (anything graph_arrays takes) at every
+    # resolution of `resolutions` from a single copy of its adjacency, the
+    # runs spread over n_threads threads (0 for one per core). Returns
+    # (partitions, modularity): partitions[k] is the partition at
+    # resolutions[k], indexed by node position, and modularity[k] its
+    # modularity at that resolution. Runs go in fixed chains of
+    # consecutive resolutions, each warm-started from the previous one, so
+    # partitions[k] can differ from louvain(G, resolutions[k]). As with
+    # louvain(), n_threads=1 and n_threads>1 can give different results;
+    # all counts above 1 agree.
+    return generate_multi_resolution(
+        *graph_arrays(G), [float(r) for r in resolutions], prune, n_threads,
+        method)
+
+
+def update_louvain(
+    G, dendrogram, edges, resolution=1, n_threads=1, progress=None, **_
+):
+    # `dendrogram` was computed on an earlier version of G, and `edges`
+    # lists the (u, v) pairs inserted into or deleted from G since then.
+    # Nodes may only have been appended to G, not removed or reordered.
     A = nx.adjacency_matrix(G)
+    index = {node: i for i, node in enumerate(G.nodes)}
+    changed = np.array(
+        [index[node] for edge in edges for node in edge[:2] if node in index],
+        dtype=np.int64)
+
+    dendrogram = update_dendrogram(
+        *csr_arrays(A), dendrogram, changed,
+        resolution, n_threads, progress)
+    return generate_partition(dendrogram, 1), dendrogram
 
+
+def metric_louvain(
+    G, X=None, resolution=1, prune=False, n_threads=1,
+    scoring="silhouette", sample_size=None, seed=0, **_
+):
+    # clusters G and returns the level of its full dendrogram that scores
+    # best on X, an embedding with one row per node of G, as an array
+    # indexed by node position. scoring is "silhouette" (euclidean), on a
+    # random sample of sample_size points drawn with `seed` if given, or
+    # "calinski_harabasz". Every level is scored in one native pass,
+    # including one level per merge of communities after the last pass.
     dendrogram = generate_full_dendrogram(
-        A.indptr, A.indices, A.data, resolution, prune)
-
-    best_score = -float("inf")
-    best_y = None
-    for level in range(1, len(dendrogram) + 1):
-        partition = generate_partition(dendrogram, level)
-        y = partition_to_vec(partition)
-        try:
-            score = scoring(X, y)
-        except ValueError:
-            score = -float("inf")
-        if score >= best_score:
-            best_y = y.copy()
-            best_score = score
-    return best_y
+        *graph_arrays(G), resolution, prune, n_threads)
+
+    level, _ = score_dendrogram(
+        dendrogram, X, scoring, sample_size or 0, seed, n_threads)
+    return partition_at_level(dendrogram, level)
@@ -11,7 +11,8 @@ ext_modules = [
         include_dirs=[
             pybind11.get_include(),
             pybind11.get_include(True), ],
-        extra_compile_args=["-Ofast", "-std=c++17"])
+        extra_compile_args=["-Ofast", "-std=c++17", "-pthread"],
+        extra_link_args=["-pthread"])
 ]
 
 
@@ -23,7 +24,7 @@ setup(
     packages=find_packages(),
     include_package_data=True,
     install_requires=["networkx", "numpy",
-                      "scipy", "pybind11", "scikit-learn"],
+                      "scipy", "pybind11"],
     classifiers=[
         "License :: OSI Approved :: MIT License",
         "Operating System :: OS Independent",
@@ -1,68 +1,98 @@
+#include <algorithm>
 #include <iostream>
 #include <stdlib.h>
-#include <pybind11/pybind11.h>
-#include <pybind11/numpy.h>
-
-namespace py = pybind11;
-using Node = int64_t;
-using Nodes = std::vector<Node>;
-using GraphNeighbors = std::vector<Nodes>;
-using Weight = float;
-using Weights = std::vector<Weight>;
-using GraphWeights = std::vector<Weights>;
-using WeightMap = std::unordered_map<Node, Weight>;
-using NodeSet = std::unordered_set<Node>;
-
-std::tuple<GraphNeighbors, GraphWeights> get_adj(
-    py::array_t<int64_t> _indptr,
-    py::array_t<int64_t> _indices,
-    py::array_t<float> _data)
-{
-    // get data buffers
-    py::buffer_info indptrBuf = _indptr.request();
-    int64_t *indptr = (int64_t *)indptrBuf.ptr;
-
-    py::buffer_info indicesBuf = _indices.request();
-    int64_t *indices = (int64_t *)indicesBuf.ptr;
-
-    py::buffer_info dataBuf = _data.request();
-    float *data = (float *)dataBuf.ptr;
-    size_t n_nodes = indptrBuf.shape[0] - 1;
-
-    GraphNeighbors graph_neighbors;
-    GraphWeights graph_weights;
-    graph_neighbors.resize(n_nodes);
-    graph_weights.resize(n_nodes);
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include "algorithm.hpp"
+#include "checkpoint.hpp"
+
+template <typename Index, typename EdgeWeight>
+CSRGraph<Index, EdgeWeight> make_csr(
+    std::shared_ptr<CSRStorage<Index, EdgeWeight>> storage)
+{
+    CSRGraph<Index, EdgeWeight> graph;
+    graph.n_nodes = storage->indptr.size() - 1;
+    graph.indptr = storage->indptr.data();
+    graph.indices = storage->indices.data();
+    graph.weights = storage->weights.data();
+    graph.storage = storage;
+    return graph;
+}
 
-    for (size_t i = 0; i < n_nodes; i++)
-    {
-        for (size_t j = indptr[i]; j < indptr[i + 1]; j++)
-        {
-            graph_neighbors[i].push_back(indices[j]);
-            graph_weights[i].push_back(data[j]);
-        }
-    }
-    return std::make_tuple(graph_neighbors, graph_weights);
+template <typename Index, typename EdgeWeight>
+CSRGraph<Index, EdgeWeight> make_csr(
+    std::vector<Index> &&indptr,
+    std::vector<Index> &&indices,
+    std::vector<EdgeWeight> &&weights)
+{
+    auto storage = std::make_shared<CSRStorage<Index, EdgeWeight>>();
+    storage->indptr = std::move(indptr);
+    storage->indices = std::move(indices);
+    storage->weights = std::move(weights);
+    return make_csr(storage);
 }
 
+template <typename Index, typename EdgeWeight>
 std::tuple<Nodes, Weights, Weights, Weights, Weights, float> init_status(
-    GraphNeighbors const &graph_neighbors,
-    GraphWeights const &graph_weights)
+    CSRGraph<Index, EdgeWeight> const &graph)
 {
-    size_t n_nodes = graph_neighbors.size();
-
     Nodes node2com;
     Weights internals;
     Weights loops;
     Weights degrees;
     Weights gdegrees;
+    float total_weight = init_status(
+        graph, node2com, internals, loops, degrees, gdegrees);
+    return std::make_tuple(
+        std::move(node2com),
+        std::move(internals),
+        std::move(loops),
+        std::move(degrees),
+        std::move(gdegrees),
+        total_weight);
+}
+
+template <typename Index, typename EdgeWeight>
+float init_status(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights &loops,
+    Weights &degrees,
+    Weights &gdegrees)
+{
+    size_t n_nodes = graph.n_nodes;
     node2com.resize(n_nodes);
     internals.resize(n_nodes);
     loops.resize(n_nodes);
     degrees.resize(n_nodes);
     gdegrees.resize(n_nodes);
 
-    float total_weight = 0;
+    // without weights the degrees are edge counts: the row length, plus
+    // the self-loops once more as they count twice
+    if constexpr (std::is_same_v<EdgeWeight, Unweighted>)
+    {
+        size_t total_degree = 0;
+        for (Node node = 0; node < n_nodes; node++)
+        {
+            Index n_loops = 0;
+            for (Index i = graph.indptr[node]; i < graph.indptr[node + 1]; i++)
+                n_loops += graph.indices[i] == node;
+            Index degree = graph.indptr[node + 1] - graph.indptr[node] + n_loops;
+            node2com[node] = node;
+            internals[node] = n_loops;
+            loops[node] = n_loops;
+            degrees[node] = degree;
+            gdegrees[node] = degree;
+            total_degree += degree;
+        }
+        return total_degree / 2.;
+    }
+
+    // summed in double, a float total stops growing on large graphs
+    double total_weight = 0;
     for (Node node = 0; node < n_nodes; node++)
     {
         node2com[node] = node;
@@ -71,12 +101,10 @@ std::tuple<Nodes, Weights, Weights, Weights, Weights, float> init_status(
         degrees[node] = 0;
         gdegrees[node] = 0;
 
-        Nodes neighbors = graph_neighbors[node];
-        Weights neighbors_weight = graph_weights[node];
-        for (size_t i = 0; i < neighbors.size(); i++)
+        for (Index i = graph.indptr[node]; i < graph.indptr[node + 1]; i++)
         {
-            Node neighbor = neighbors[i];
-            Weight weight = neighbors_weight[i];
+            Node neighbor = graph.indices[i];
+            double weight = graph.weight(i);
             if (neighbor == node)
             {
                 internals[node] += weight;
@@ -88,345 +116,1356 @@ std::tuple<Nodes, Weights, Weights, Weights, Weights, float> init_status(
             total_weight += weight;
         }
     }
-    total_weight /= 2;
-    return std::make_tuple(
-        node2com,
-        internals,
-        loops,
-        degrees,
-        gdegrees,
-        total_weight);
+    return total_weight / 2;
+}
+
+// Sum of the modularity terms of communities [begin, end), split in
+// halves down to blocks short enough to be summed in one vectorized loop.
+// The rounding error then grows with the log of the number of blocks.
+double modularity_sum(
+    Weight const *internals,
+    Weight const *degrees,
+    size_t begin,
+    size_t end,
+    double internal_scale,
+    double degree_scale)
+{
+    if (end - begin > 1024)
+    {
+        size_t middle = begin + (end - begin) / 2;
+        return modularity_sum(internals, degrees, begin, middle,
+                              internal_scale, degree_scale) +
+               modularity_sum(internals, degrees, middle, end,
+                              internal_scale, degree_scale);
+    }
+
+    double result = 0;
+    for (size_t com = begin; com < end; com++)
+    {
+        double tmp = degrees[com] * degree_scale;
+        result += internals[com] * internal_scale - tmp * tmp;
+    }
+    return result;
 }
 
-float modularity(
+// Computed in double, as the 1e-7 convergence threshold is within a few
+// float ulps of a modularity close to 1
+double modularity(
     Weights const &internals,
     Weights const &degrees,
     float total_weight,
     float resolution)
 {
-    float result = 0;
-    for (Node com = 0; com < degrees.size(); com++)
-    {
-        float tmp = degrees[com] / (2. * total_weight);
-        result += resolution * internals[com] / total_weight;
-        result -= tmp * tmp;
-    }
-    return result;
+    return modularity_sum(internals.data(), degrees.data(), 0, degrees.size(),
+                          double(resolution) / total_weight,
+                          1 / (2. * total_weight));
 }
 
-WeightMap neighcom(
-    GraphNeighbors const &graph_neighbors,
-    GraphWeights const &graph_weights,
+template <typename Index, typename EdgeWeight>
+void neighcom(
+    CSRGraph<Index, EdgeWeight> const &graph,
     Nodes const &node2com,
-    Node node)
+    Node node,
+    DenseWeightMap &neighbor_weight)
 {
-    WeightMap neighbor_weight;
-    Nodes neighbors = graph_neighbors[node];
-    Weights neighbors_weight = graph_weights[node];
-
-    for (size_t i = 0; i < neighbors.size(); i++)
+    neighbor_weight.clear();
+    for (Index i = graph.indptr[node]; i < graph.indptr[node + 1]; i++)
     {
-        Node neighbor = neighbors[i];
+        Node neighbor = graph.indices[i];
         if (neighbor == node)
             continue;
 
         Node neighborcom = node2com[neighbor];
-        neighbor_weight[neighborcom] += neighbors_weight[i];
+        neighbor_weight.add(neighborcom, graph.weight(i));
+    }
+}
+
+// Modularity increase, up to a factor of 1 / total_weight, of moving a
+// node of degree node_gdegree into a community of degree `degree` that it
+// is linked to by `weight`. The gain of a move is the increase towards
+// the new community minus the one towards the old community without the
+// node, and the sum of the gains of a sweep over total_weight is the
+// change of modularity.
+inline float move_increase(
+    Weight weight,
+    Weight degree,
+    Weight node_gdegree,
+    float resolution,
+    float m)
+{
+    return resolution * weight - degree * node_gdegree / m;
+}
+
+// Neighbor community with the largest modularity gain, or `node_com` if
+// none beats `best_increase`. `degrees` may still count the node in its
+// own community, in which case `own_degree` is what is left without it.
+// The gains are computed in one pass and reduced in a second one so that
+// both loops run over contiguous arrays.
+Node best_community(
+    DenseWeightMap &neighbor_weight,
+    Weights const &degrees,
+    Node node_com,
+    Weight own_degree,
+    Weight node_gdegree,
+    float resolution,
+    float m,
+    float &best_increase)
+{
+    size_t n_touched = neighbor_weight.touched.size();
+    Node const *coms = neighbor_weight.touched.data();
+    Weight const *weights = neighbor_weight.weight.data();
+    Weight const *com_degrees = degrees.data();
+    neighbor_weight.gains.resize(n_touched);
+    float *gains = neighbor_weight.gains.data();
+
+    float scale = node_gdegree / m;
+    for (size_t k = 0; k < n_touched; k++)
+    {
+        Node com = coms[k];
+        Weight weight = weights[com];
+        Weight degree = com == node_com ? own_degree : com_degrees[com];
+        float increase = resolution * weight - degree * scale;
+        gains[k] = weight > 0 ? increase : std::numeric_limits<float>::lowest();
+    }
+
+    size_t best = n_touched;
+    for (size_t k = 0; k < n_touched; k++)
+    {
+        if (gains[k] > best_increase)
+        {
+            best_increase = gains[k];
+            best = k;
+        }
+    }
+    return best < n_touched ? coms[best] : node_com;
+}
+
+// Scratch space of local moving and refinement. The level loops keep one
+// for the whole run in LevelBuffers: it is sized by the first level, and
+// the next ones, which are smaller, only use a prefix of it.
+struct MoveBuffers
+{
+    // weights towards the neighbor communities of a node, for the serial
+    // passes and for every thread
+    DenseWeightMap neighbor_weight;
+    std::vector<DenseWeightMap> thread_neighbor_weight;
+    // decisions of a batch (see move_batch)
+    Nodes targets;
+    Weights target_weights;
+    Weights own_weights;
+    // coloring, and nodes grouped by color (see group_by_color)
+    Nodes colors;
+    Nodes forbidden;
+    Nodes order;
+    std::vector<size_t> color_start;
+    std::vector<size_t> color_next;
+    // pending nodes of pruned local moving
+    Nodes queued;
+    Nodes queue;
+    Nodes next_queue;
+    std::vector<char> in_queue;
+    // refine_partition and rebuild_internals
+    Nodes refined;
+    Nodes refined_size;
+    Weights refined_degrees;
+    Weights external;
+    Weights node_internals;
+
+    size_t bytes() const
+    {
+        size_t total = neighbor_weight.bytes();
+        for (DenseWeightMap const &map : thread_neighbor_weight)
+            total += map.bytes();
+        return total + capacity_bytes(targets) +
+               capacity_bytes(target_weights) + capacity_bytes(own_weights) +
+               capacity_bytes(colors) + capacity_bytes(forbidden) +
+               capacity_bytes(order) + capacity_bytes(color_start) +
+               capacity_bytes(color_next) + capacity_bytes(queued) +
+               capacity_bytes(queue) + capacity_bytes(next_queue) +
+               capacity_bytes(in_queue) + capacity_bytes(refined) +
+               capacity_bytes(refined_size) +
+               capacity_bytes(refined_degrees) + capacity_bytes(external) +
+               capacity_bytes(node_internals);
     }
-    return neighbor_weight;
+};
+
+// Makes `map` take keys in [0, n_keys), keeping it if it already does.
+// Every user clears it first, so it may be left dirty.
+void fit_keys(DenseWeightMap &map, size_t n_keys)
+{
+    if (map.weight.size() < n_keys)
+        map.resize(n_keys);
+}
+
+// Sets `nodes` to all the nodes of the graph, in order
+void all_nodes(Nodes &nodes, size_t n_nodes)
+{
+    nodes.resize(n_nodes);
+    for (Node node = 0; node < n_nodes; node++)
+        nodes[node] = node;
 }
 
+template <typename Index, typename EdgeWeight>
 void one_level(
-    GraphNeighbors const &graph_neighbors,
-    GraphWeights const &graph_weights,
+    CSRGraph<Index, EdgeWeight> const &graph,
     Nodes &node2com,
     Weights &internals,
     Weights const &loops,
     Weights &degrees,
     Weights const &gdegrees,
     float total_weight,
-    float resolution)
+    float resolution,
+    MoveBuffers &buffers,
+    Progress *progress)
 {
-    bool modified = true;
-    float cur_mod = modularity(internals,
-                               degrees,
-                               total_weight,
-                               resolution);
-    float new_mod = cur_mod;
-    size_t n_nodes = graph_neighbors.size();
+    size_t n_nodes = graph.n_nodes;
     float m = 2 * total_weight;
-    while (modified)
+    // kept up to date from the gain of every move rather than recomputed
+    double mod = modularity(internals, degrees, total_weight, resolution);
+
+    DenseWeightMap &neighbor_weight = buffers.neighbor_weight;
+    fit_keys(neighbor_weight, n_nodes);
+    while (true)
     {
-        modified = false;
-        cur_mod = new_mod;
+        size_t n_moved = 0;
+        double gain = 0;
 
         for (Node node = 0; node < n_nodes; node++)
         {
             Node node_com = node2com[node];
-            WeightMap neighbor_weight = neighcom(
-                graph_neighbors, graph_weights, node2com, node);
+            neighcom(graph, node2com, node, neighbor_weight);
 
             // remove
             Weight node_gdegree = gdegrees[node];
             Weight node_loop = loops[node];
             node2com[node] = -1;
             degrees[node_com] -= node_gdegree;
-            internals[node_com] -= neighbor_weight[node_com] + node_loop;
+            internals[node_com] -= neighbor_weight.weight[node_com] + node_loop;
 
-            Node best_com = node_com;
             float best_increase = 0;
-            for (auto [com, weight] : neighbor_weight)
+            Node best_com = best_community(
+                neighbor_weight, degrees, node_com, degrees[node_com],
+                node_gdegree, resolution, m, best_increase);
+            if (best_com != node_com)
             {
-                if (weight <= 0)
-                    continue;
-
-                float increase = resolution * weight - degrees[com] * node_gdegree / m;
-                if (increase > best_increase)
-                {
-                    best_increase = increase;
-                    best_com = com;
-                }
+                gain += best_increase - move_increase(
+                    neighbor_weight.weight[node_com], degrees[node_com],
+                    node_gdegree, resolution, m);
+                n_moved++;
             }
 
             // insert
             node2com[node] = best_com;
             degrees[best_com] += node_gdegree;
-            internals[best_com] += neighbor_weight[best_com] + node_loop;
-            if (best_com != node_com)
-                modified = true;
+            internals[best_com] += neighbor_weight.weight[best_com] + node_loop;
         }
 
-        new_mod = modularity(internals,
-                             degrees,
-                             total_weight,
-                             resolution);
-        if (new_mod - cur_mod < 0.0000001)
+        gain /= total_weight;
+        mod += gain;
+        if (progress)
+        {
+            progress->sweep(n_moved, mod);
+            if (progress->stopped())
+                break;
+        }
+        if (n_moved == 0 || gain < 0.0000001)
             break;
     }
 }
 
-bool sort_by_increase(const std::tuple<Node, Node, float, Weight> &a,
-                      const std::tuple<Node, Node, float, Weight> &b)
+template <typename Index, typename EdgeWeight>
+void one_level(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights const &loops,
+    Weights &degrees,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    Progress *progress)
 {
-    return (std::get<2>(a) > std::get<2>(b));
+    MoveBuffers buffers;
+    one_level(graph,
+              node2com, internals, loops, degrees, gdegrees,
+              total_weight, resolution, buffers, progress);
+}
+
+// Recomputes the weight inside every community of node2com from scratch,
+// with node_internals as scratch space
+template <typename Index, typename EdgeWeight>
+void rebuild_internals(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes const &node2com,
+    Weights &internals,
+    Weights const &loops,
+    ThreadPool &pool,
+    Weights &node_internals)
+{
+    size_t n_nodes = graph.n_nodes;
+    node_internals.resize(n_nodes);
+    pool.parallel_for(0, n_nodes, [&](size_t node)
+    {
+        Node node_com = node2com[node];
+        Weight inside = 0;
+        for (Index i = graph.indptr[node]; i < graph.indptr[node + 1]; i++)
+        {
+            Node neighbor = graph.indices[i];
+            if (neighbor != node && node2com[neighbor] == node_com)
+                inside += graph.weight(i);
+        }
+        node_internals[node] = inside / 2 + loops[node];
+    });
+    std::fill(internals.begin(), internals.end(), 0);
+    for (Node node = 0; node < n_nodes; node++)
+        internals[node2com[node]] += node_internals[node];
 }
 
-void one_level_each(
-    GraphNeighbors const &graph_neighbors,
-    GraphWeights const &graph_weights,
+// Moves every node to membership[node] and updates the status to match
+template <typename Index, typename EdgeWeight>
+void set_communities(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes const &membership,
     Nodes &node2com,
     Weights &internals,
     Weights const &loops,
     Weights &degrees,
     Weights const &gdegrees,
-    float total_weight,
+    ThreadPool &pool,
+    MoveBuffers &buffers)
+{
+    size_t n_nodes = graph.n_nodes;
+    node2com = membership;
+    std::fill(degrees.begin(), degrees.end(), 0);
+    for (Node node = 0; node < n_nodes; node++)
+        degrees[node2com[node]] += gdegrees[node];
+    rebuild_internals(graph, node2com, internals, loops, pool,
+                      buffers.node_internals);
+}
+
+template <typename Index, typename EdgeWeight>
+double partition_modularity(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes const &partition,
     float resolution)
 {
-    size_t n_nodes = graph_neighbors.size();
-    float m = 2 * total_weight;
+    Nodes node2com;
+    Weights internals;
+    Weights loops;
+    Weights degrees;
+    Weights gdegrees;
+    float total_weight = init_status(
+        graph, node2com, internals, loops, degrees, gdegrees);
+    ThreadPool pool(1);
+    MoveBuffers buffers;
+    set_communities(graph, partition,
+                    node2com, internals, loops, degrees, gdegrees, pool,
+                    buffers);
+    return modularity(internals, degrees, total_weight, resolution);
+}
 
-    std::vector<std::tuple<Node, Node, float, Weight>> best_moves;
+// Greedy coloring of the graph in node order: adjacent nodes never share
+// a color. `forbidden` is scratch space.
+template <typename Index, typename EdgeWeight>
+void color_nodes(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &colors,
+    Nodes &forbidden)
+{
+    size_t n_nodes = graph.n_nodes;
+    colors.assign(n_nodes, -1);
+    forbidden.clear();
+    size_t n_colors = 0;
     for (Node node = 0; node < n_nodes; node++)
     {
+        for (Index i = graph.indptr[node]; i < graph.indptr[node + 1]; i++)
+        {
+            Node color = colors[graph.indices[i]];
+            if (color >= 0)
+                forbidden[color] = node;
+        }
+        Node color = 0;
+        while (color < n_colors && forbidden[color] == node)
+            color++;
+        if (color == n_colors)
+        {
+            forbidden.push_back(-1);
+            n_colors++;
+        }
+        colors[node] = color;
+    }
+}
+
+// Stable sort of `nodes` by color into `order`, with the offset at which
+// each color starts in color_start. `next` is scratch space.
+void group_by_color(
+    Nodes const &nodes,
+    Nodes const &colors,
+    Nodes &order,
+    std::vector<size_t> &color_start,
+    std::vector<size_t> &next)
+{
+    Node n_colors = 0;
+    for (Node node : nodes)
+        n_colors = std::max(n_colors, colors[node] + 1);
+
+    color_start.assign(n_colors + 1, 0);
+    for (Node node : nodes)
+        color_start[colors[node] + 1]++;
+    for (Node color = 0; color < n_colors; color++)
+        color_start[color + 1] += color_start[color];
+
+    order.resize(nodes.size());
+    next.assign(color_start.begin(), color_start.end() - 1);
+    for (Node node : nodes)
+        order[next[colors[node]]++] = node;
+}
+
+// Nodes are moved in fixed-size batches of a single color. Every node of
+// a batch picks its best community in parallel, then the moves are
+// applied serially and kept only if they still improve on the now updated
+// community degrees. Nodes of a batch are never adjacent, so the weights
+// towards their neighbor communities cannot be changed by the other moves
+// of the batch. The batches do not depend on the number of threads, so
+// the result is the same for any thread count above one, and on any
+// machine: the count asked for picks the batches over the serial passes
+// (see move_nodes) even when the pool has fewer cores to run them on. A
+// single thread finds another partition.
+const size_t PARALLEL_BATCH_SIZE = 4096;
+
+// Sizes the decisions of a batch and the neighbor maps of the threads
+void fit_batches(MoveBuffers &buffers, size_t n_threads)
+{
+    buffers.targets.resize(PARALLEL_BATCH_SIZE);
+    buffers.target_weights.resize(PARALLEL_BATCH_SIZE);
+    buffers.own_weights.resize(PARALLEL_BATCH_SIZE);
+    if (buffers.thread_neighbor_weight.size() < n_threads)
+        buffers.thread_neighbor_weight.resize(n_threads);
+}
+
+// Moves the nodes of one batch and calls on_move(node, com) for each node
+// that changed community. Returns the number of moves, and adds their
+// gains (see move_increase) to `gain`.
+template <typename Index, typename EdgeWeight, typename F>
+size_t move_batch(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Node const *nodes,
+    size_t n_batch,
+    Nodes &node2com,
+    Weights &internals,
+    Weights const &loops,
+    Weights &degrees,
+    Weights const &gdegrees,
+    float m,
+    float resolution,
+    ThreadPool &pool,
+    MoveBuffers &buffers,
+    double &gain,
+    F const &on_move)
+{
+    size_t n_nodes = graph.n_nodes;
+
+    // decide
+    pool.parallel_for_thread(0, n_batch, [&](size_t thread, size_t k)
+    {
+        DenseWeightMap &neighbor_weight = buffers.thread_neighbor_weight[thread];
+        fit_keys(neighbor_weight, n_nodes);
+
+        Node node = nodes[k];
+        Node node_com = node2com[node];
+        neighcom(graph, node2com, node, neighbor_weight);
+        Weight node_gdegree = gdegrees[node];
+
+        float best_increase = 0;
+        Node best_com = best_community(
+            neighbor_weight, degrees, node_com,
+            degrees[node_com] - node_gdegree,
+            node_gdegree, resolution, m, best_increase);
+
+        buffers.targets[k] = best_com;
+        buffers.target_weights[k] = neighbor_weight.weight[best_com];
+        buffers.own_weights[k] = neighbor_weight.weight[node_com];
+    }, 32);
+
+    // apply
+    size_t n_moved = 0;
+    for (size_t k = 0; k < n_batch; k++)
+    {
+        Node node = nodes[k];
         Node node_com = node2com[node];
-        WeightMap neighbor_weight = neighcom(
-            graph_neighbors, graph_weights, node2com, node);
+        Node best_com = buffers.targets[k];
+        if (best_com == node_com)
+            continue;
 
-        // remove
         Weight node_gdegree = gdegrees[node];
-        Weight node_loop = loops[node];
-        node2com[node] = -1;
+        float stay = move_increase(
+            buffers.own_weights[k], degrees[node_com] - node_gdegree,
+            node_gdegree, resolution, m);
+        float increase = move_increase(
+            buffers.target_weights[k], degrees[best_com],
+            node_gdegree, resolution, m);
+        if (increase <= stay || increase <= 0)
+            continue;
+
         degrees[node_com] -= node_gdegree;
-        internals[node_com] -= neighbor_weight[node_com] + node_loop;
+        internals[node_com] -= buffers.own_weights[k] + loops[node];
+        degrees[best_com] += node_gdegree;
+        internals[best_com] += buffers.target_weights[k] + loops[node];
+        node2com[node] = best_com;
+        on_move(node, best_com);
+        gain += increase - stay;
+        n_moved++;
+    }
+    return n_moved;
+}
 
-        Node best_com = node_com;
-        float best_increase = -INFINITY;
-        for (auto [com, weight] : neighbor_weight)
-        {
-            if (weight <= 0)
-                continue;
+template <typename Index, typename EdgeWeight>
+void one_level_parallel(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights const &loops,
+    Weights &degrees,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    ThreadPool &pool,
+    MoveBuffers &buffers,
+    Progress *progress)
+{
+    size_t n_nodes = graph.n_nodes;
+    float m = 2 * total_weight;
 
-            float increase = resolution * weight - degrees[com] * node_gdegree / m;
-            if (increase > best_increase)
+    all_nodes(buffers.queued, n_nodes);
+    color_nodes(graph, buffers.colors, buffers.forbidden);
+    group_by_color(buffers.queued, buffers.colors,
+                   buffers.order, buffers.color_start, buffers.color_next);
+    Nodes const &order = buffers.order;
+    std::vector<size_t> const &color_start = buffers.color_start;
+    size_t n_colors = color_start.size() - 1;
+    fit_batches(buffers, pool.size());
+
+    double mod = modularity(internals, degrees, total_weight, resolution);
+    while (true)
+    {
+        size_t n_moved = 0;
+        double gain = 0;
+
+        for (size_t color = 0; color < n_colors; color++)
+        {
+            for (size_t start = color_start[color];
+                 start < color_start[color + 1];
+                 start += PARALLEL_BATCH_SIZE)
             {
-                best_increase = increase;
-                best_com = com;
+                size_t stop = std::min(start + PARALLEL_BATCH_SIZE,
+                                       color_start[color + 1]);
+                n_moved += move_batch(
+                    graph, order.data() + start, stop - start,
+                    node2com, internals, loops, degrees, gdegrees,
+                    m, resolution, pool, buffers, gain,
+                    [](Node, Node) {});
             }
         }
 
-        best_moves.push_back(
-            std::make_tuple(
-                node, best_com, best_increase, neighbor_weight[best_com]));
+        gain /= total_weight;
+        mod += gain;
+        if (progress)
+        {
+            progress->sweep(n_moved, mod);
+            if (progress->stopped())
+                break;
+        }
+        if (n_moved == 0 || gain < 0.0000001)
+            break;
+    }
+}
 
-        // insert
-        node2com[node] = node_com;
-        degrees[node_com] += node_gdegree;
-        internals[node_com] += neighbor_weight[node_com] + node_loop;
+template <typename Index, typename EdgeWeight>
+void one_level_parallel(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights const &loops,
+    Weights &degrees,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    ThreadPool &pool,
+    Progress *progress)
+{
+    MoveBuffers buffers;
+    one_level_parallel(graph,
+                       node2com, internals, loops, degrees, gdegrees,
+                       total_weight, resolution, pool, buffers, progress);
+}
+
+// Candidate merge of communities a < b, valid as long as neither has
+// changed since it was queued
+struct MergeCandidate
+{
+    float gain;
+    Node a;
+    Node b;
+    size_t version_a;
+    size_t version_b;
+
+    // the heap pops the largest gain first, then the smallest pair
+    bool operator<(MergeCandidate const &other) const
+    {
+        if (gain != other.gain)
+            return gain < other.gain;
+        return std::tie(a, b) > std::tie(other.a, other.b);
+    }
+};
+
+template <typename Index>
+void merge_levels(
+    CSRGraph<Index> const &graph,
+    Weights &internals,
+    Weights &degrees,
+    float total_weight,
+    float resolution,
+    double mod,
+    Merges &merges,
+    Progress *progress,
+    size_t buffer_bytes)
+{
+    Progress ignored;
+    if (!progress)
+        progress = &ignored;
+    size_t n_nodes = graph.n_nodes;
+    float m = 2 * total_weight;
+    auto pair_gain = [&](Node a, Node b, Weight weight)
+    { return resolution * weight - degrees[a] * (degrees[b] / m); };
+
+    // community adjacency, and the entries of the CSR graph it stands for
+    std::vector<WeightMap> links(n_nodes);
+    size_t n_links = 0;
+    size_t n_looped = 0;
+    for (Node node = 0; node < n_nodes; node++)
+    {
+        for (Index i = graph.indptr[node]; i < graph.indptr[node + 1]; i++)
+        {
+            Node neighbor = graph.indices[i];
+            if (neighbor != node)
+                links[node][neighbor] += graph.weight(i);
+        }
+        n_links += links[node].size();
+        n_looped += internals[node] > 0;
+    }
+
+    std::vector<size_t> versions(n_nodes, 0);
+    std::priority_queue<MergeCandidate> heap;
+    for (Node node = 0; node < n_nodes; node++)
+    {
+        for (auto const &[neighbor, weight] : links[node])
+        {
+            if (node < neighbor && weight > 0)
+                heap.push({pair_gain(node, neighbor, weight),
+                           node, neighbor, 0, 0});
+        }
     }
 
-    sort(best_moves.begin(), best_moves.end(), sort_by_increase);
-    auto [node, best_com, best_increase, weight] = best_moves[0];
-    node2com[node] = best_com;
-    degrees[best_com] += gdegrees[node];
-    internals[best_com] += weight + loops[node];
+    // the name of every community, its smallest node
+    Nodes names(n_nodes);
+    for (Node node = 0; node < n_nodes; node++)
+        names[node] = node;
+    size_t n_alive = n_nodes;
+
+    while (!heap.empty() && !progress->stopped())
+    {
+        MergeCandidate best = heap.top();
+        heap.pop();
+        if (versions[best.a] != best.version_a ||
+            versions[best.b] != best.version_b)
+            continue;
+
+        progress->start_level(n_alive, n_links + n_looped);
+        mod += double(best.gain) / total_weight;
+
+        // the community with fewer links is folded into the other one,
+        // which takes the smaller of their names
+        Node from = best.b;
+        Node into = best.a;
+        if (links[from].size() > links[into].size())
+            std::swap(from, into);
+        merges.emplace_back(std::max(names[from], names[into]),
+                            std::min(names[from], names[into]));
+        names[into] = merges.back().second;
+        n_alive--;
+        progress->sweep(1, mod);
+        progress->add_time(&LevelStats::move_seconds);
+
+        n_looped -= (internals[from] > 0) + (internals[into] > 0);
+        internals[into] += internals[from] + links[from][into];
+        n_looped += internals[into] > 0;
+        degrees[into] += degrees[from];
+
+        WeightMap &into_links = links[into];
+        into_links.erase(from);
+        n_links -= 2;
+        for (auto const &[neighbor, weight] : links[from])
+        {
+            if (neighbor == into)
+                continue;
+            WeightMap &neighbor_links = links[neighbor];
+            neighbor_links.erase(from);
+            neighbor_links[into] += weight;
+            auto [link, inserted] = into_links.try_emplace(neighbor, 0);
+            link->second += weight;
+            if (!inserted)
+                n_links -= 2;
+        }
+        WeightMap().swap(links[from]);
+
+        // every gain of `into` changes with its degree
+        versions[from]++;
+        versions[into]++;
+        for (auto const &[neighbor, weight] : into_links)
+        {
+            if (weight <= 0)
+                continue;
+            Node a = std::min(into, neighbor);
+            Node b = std::max(into, neighbor);
+            heap.push({pair_gain(into, neighbor, weight),
+                       a, b, versions[a], versions[b]});
+        }
+        progress->add_time(&LevelStats::aggregate_seconds);
+        progress->end_level(n_alive, mod, buffer_bytes);
+    }
 }
 
+// Pruned local moving that starts from the nodes in `queued` only. There
+// are no sweeps over the whole graph here, so every n_nodes visits (and
+// the visits left when the queue runs out) are reported as one.
+template <typename Index, typename EdgeWeight>
 void one_level_prune(
-    GraphNeighbors const &graph_neighbors,
-    GraphWeights const &graph_weights,
+    CSRGraph<Index, EdgeWeight> const &graph,
     Nodes &node2com,
     Weights &internals,
     Weights const &loops,
     Weights &degrees,
     Weights const &gdegrees,
     float total_weight,
-    float resolution)
+    float resolution,
+    Nodes const &queued,
+    MoveBuffers &buffers,
+    Progress *progress)
 {
-    size_t n_nodes = graph_neighbors.size();
+    size_t n_nodes = graph.n_nodes;
     float m = 2 * total_weight;
 
-    NodeSet P;
-    for (Node i = 0; i < n_nodes; i++)
+    DenseWeightMap &neighbor_weight = buffers.neighbor_weight;
+    fit_keys(neighbor_weight, n_nodes);
+
+    // FIFO of pending nodes. A node is queued at most once, so a ring
+    // buffer of n_nodes slots is enough.
+    Nodes &queue = buffers.queue;
+    std::vector<char> &in_queue = buffers.in_queue;
+    queue.resize(n_nodes);
+    in_queue.assign(n_nodes, false);
+    size_t head = 0;
+    size_t n_queued = 0;
+    for (Node node : queued)
     {
-        P.insert(i);
+        if (in_queue[node])
+            continue;
+        queue[n_queued++] = node;
+        in_queue[node] = true;
     }
 
-    while (P.size() != 0)
+    // only needed for the reports, and then kept up to date from the gains
+    double mod = progress ? modularity(internals, degrees, total_weight, resolution) : 0;
+    double gain = 0;
+    size_t n_visited = 0;
+    size_t n_moved = 0;
+    while (n_queued != 0)
     {
-
-        Node node = *P.begin();
-        P.erase(P.begin());
+        Node node = queue[head];
+        head = head + 1 == n_nodes ? 0 : head + 1;
+        n_queued--;
+        in_queue[node] = false;
 
         Node node_com = node2com[node];
-        WeightMap neighbor_weight = neighcom(
-            graph_neighbors, graph_weights, node2com, node);
+        neighcom(graph, node2com, node, neighbor_weight);
 
         // remove
         node2com[node] = -1;
         degrees[node_com] -= gdegrees[node];
-        internals[node_com] -= neighbor_weight[node_com] + loops[node];
+        internals[node_com] -= neighbor_weight.weight[node_com] + loops[node];
 
-        Node best_com = node_com;
         float best_increase = 0;
-        for (auto [com, weight] : neighbor_weight)
-        {
-            if (weight <= 0)
-                continue;
-
-            float increase = resolution * weight;
-            increase -= degrees[com] * gdegrees[node] / m;
-            if (increase > best_increase)
-            {
-                best_increase = increase;
-                best_com = com;
-            }
-        }
+        Node best_com = best_community(
+            neighbor_weight, degrees, node_com, degrees[node_com],
+            gdegrees[node], resolution, m, best_increase);
+        if (best_com != node_com)
+            gain += best_increase - move_increase(
+                neighbor_weight.weight[node_com], degrees[node_com],
+                gdegrees[node], resolution, m);
 
         // insert
         node2com[node] = best_com;
         degrees[best_com] += gdegrees[node];
-        internals[best_com] += neighbor_weight[best_com] + loops[node];
+        internals[best_com] += neighbor_weight.weight[best_com] + loops[node];
 
         if (best_com != node_com)
         {
-            Nodes neighbors = graph_neighbors[node];
-            for (Node neighbor : neighbors)
+            for (Index i = graph.indptr[node]; i < graph.indptr[node + 1]; i++)
             {
-                if (neighbor == node)
+                Node neighbor = graph.indices[i];
+                if (neighbor == node || in_queue[neighbor])
                     continue;
                 Node neighbor_c = node2com[neighbor];
                 if (neighbor_c != best_com)
                 {
-                    P.insert(neighbor);
+                    size_t tail = head + n_queued;
+                    queue[tail >= n_nodes ? tail - n_nodes : tail] = neighbor;
+                    n_queued++;
+                    in_queue[neighbor] = true;
                 }
             }
+            n_moved++;
+        }
+
+        n_visited++;
+        if (progress && (n_visited == n_nodes || n_queued == 0))
+        {
+            mod += gain / total_weight;
+            gain = 0;
+            progress->sweep(n_moved, mod);
+            if (progress->stopped())
+                break;
+            n_visited = 0;
+            n_moved = 0;
         }
     }
 }
 
-std::tuple<GraphNeighbors, Nodes> renumber(
-    GraphNeighbors const &graph_neighbors,
-    GraphWeights const &graph_weights,
-    Nodes const &node2com)
+template <typename Index, typename EdgeWeight>
+void one_level_prune(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights const &loops,
+    Weights &degrees,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    MoveBuffers &buffers,
+    Progress *progress)
 {
-    size_t n_nodes = node2com.size();
-    Nodes com_n_nodes;
-    com_n_nodes.resize(n_nodes);
-    for (Node node = 0; node < n_nodes; node++)
-    {
-        com_n_nodes[node2com[node]] += 1;
-    }
-
-    Nodes com_new_index;
-    com_new_index.resize(n_nodes);
-    float final_index = 0;
-    for (Node com = 0; com < n_nodes; com++)
-    {
-        if (com_n_nodes[com] <= 0)
-            continue;
-
-        com_new_index[com] = final_index;
-        final_index++;
-    }
-
-    GraphNeighbors new_communities;
-    new_communities.resize(final_index);
-    Nodes new_node2com;
-    new_node2com.resize(n_nodes);
-    for (Node node = 0; node < n_nodes; node++)
-    {
-        Node com = node2com[node];
-        Node new_com = com_new_index[com];
-        new_communities[new_com].push_back(node);
-        new_node2com[node] = new_com;
-    }
-    return std::make_tuple(new_communities, new_node2com);
+    all_nodes(buffers.queued, graph.n_nodes);
+    one_level_prune(graph,
+                    node2com, internals, loops, degrees, gdegrees,
+                    total_weight, resolution, buffers.queued, buffers,
+                    progress);
 }
 
-std::tuple<GraphNeighbors, GraphWeights, size_t> induced_graph(
-    GraphNeighbors const &graph_neighbors,
-    GraphWeights const &graph_weights,
-    GraphNeighbors const &communities,
-    Nodes const &node2com)
+template <typename Index, typename EdgeWeight>
+void one_level_prune(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights const &loops,
+    Weights &degrees,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    Progress *progress)
 {
-    size_t new_n_nodes = communities.size();
-    GraphNeighbors new_graph_neighbors;
-    GraphWeights new_graph_weights;
-    new_graph_neighbors.resize(new_n_nodes);
-    new_graph_weights.resize(new_n_nodes);
+    MoveBuffers buffers;
+    one_level_prune(graph,
+                    node2com, internals, loops, degrees, gdegrees,
+                    total_weight, resolution, buffers, progress);
+}
 
-    WeightMap to_insert;
+template <typename Index, typename EdgeWeight>
+void one_level_prune(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights const &loops,
+    Weights &degrees,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    Nodes const &queued,
+    Progress *progress)
+{
+    MoveBuffers buffers;
+    one_level_prune(graph,
+                    node2com, internals, loops, degrees, gdegrees,
+                    total_weight, resolution, queued, buffers, progress);
+}
 
-    for (Node i = 0; i < new_n_nodes; i++)
+// Parallel counterpart of one_level_prune. The pending nodes are handled
+// in rounds: each round moves the whole queue through move_batch, color by
+// color, and the neighbors of the nodes that moved make up the next one.
+template <typename Index, typename EdgeWeight>
+void one_level_prune_parallel(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights const &loops,
+    Weights &degrees,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    ThreadPool &pool,
+    Nodes const &queued,
+    MoveBuffers &buffers,
+    Progress *progress)
+{
+    size_t n_nodes = graph.n_nodes;
+    float m = 2 * total_weight;
+
+    color_nodes(graph, buffers.colors, buffers.forbidden);
+    fit_batches(buffers, pool.size());
+
+    Nodes &queue = buffers.queue;
+    Nodes &next_queue = buffers.next_queue;
+    std::vector<char> &in_queue = buffers.in_queue;
+    queue.clear();
+    next_queue.clear();
+    in_queue.assign(n_nodes, false);
+    for (Node node : queued)
     {
-        to_insert.clear();
-        Nodes nodes = communities[i];
-        for (Node j = 0; j < nodes.size(); j++)
+        if (!in_queue[node])
+            queue.push_back(node);
+        in_queue[node] = true;
+    }
+    for (Node node : queue)
+        in_queue[node] = false;
+
+    auto requeue_neighbors = [&](Node node, Node best_com)
+    {
+        for (Index i = graph.indptr[node]; i < graph.indptr[node + 1]; i++)
+        {
+            Node neighbor = graph.indices[i];
+            if (neighbor == node || in_queue[neighbor])
+                continue;
+            if (node2com[neighbor] != best_com)
+            {
+                next_queue.push_back(neighbor);
+                in_queue[neighbor] = true;
+            }
+        }
+    };
+
+    // rounds are reported the same way as one_level_prune's visits
+    double mod = progress ? modularity(internals, degrees, total_weight, resolution) : 0;
+    double gain = 0;
+    size_t n_visited = 0;
+    size_t n_moved = 0;
+    while (queue.size() != 0)
+    {
+        group_by_color(queue, buffers.colors,
+                       buffers.order, buffers.color_start, buffers.color_next);
+        Nodes const &order = buffers.order;
+        std::vector<size_t> const &color_start = buffers.color_start;
+        size_t n_colors = color_start.size() - 1;
+        for (size_t color = 0; color < n_colors; color++)
         {
-            Node node = nodes[j];
-            Nodes neighbors = graph_neighbors[node];
-            Weights neighbors_weight = graph_weights[node];
-            for (size_t k = 0; k < neighbors.size(); k++)
+            for (size_t start = color_start[color];
+                 start < color_start[color + 1];
+                 start += PARALLEL_BATCH_SIZE)
             {
-                Node neighbor = neighbors[k];
-                Weight neighbor_weight = neighbors_weight[k];
-                Node neighbor_com = node2com[neighbor];
+                size_t stop = std::min(start + PARALLEL_BATCH_SIZE,
+                                       color_start[color + 1]);
+                n_moved += move_batch(
+                    graph, order.data() + start, stop - start,
+                    node2com, internals, loops, degrees, gdegrees,
+                    m, resolution, pool, buffers, gain, requeue_neighbors);
+            }
+        }
+
+        for (Node node : next_queue)
+            in_queue[node] = false;
+        n_visited += queue.size();
+        queue.swap(next_queue);
+        next_queue.clear();
+
+        if (progress && (n_visited >= n_nodes || queue.empty()))
+        {
+            mod += gain / total_weight;
+            gain = 0;
+            progress->sweep(n_moved, mod);
+            if (progress->stopped())
+                break;
+            n_visited = 0;
+            n_moved = 0;
+        }
+    }
+}
+
+template <typename Index, typename EdgeWeight>
+void one_level_prune_parallel(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights const &loops,
+    Weights &degrees,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    ThreadPool &pool,
+    MoveBuffers &buffers,
+    Progress *progress)
+{
+    all_nodes(buffers.queued, graph.n_nodes);
+    one_level_prune_parallel(graph,
+                             node2com, internals, loops, degrees, gdegrees,
+                             total_weight, resolution, pool, buffers.queued,
+                             buffers, progress);
+}
+
+template <typename Index, typename EdgeWeight>
+void one_level_prune_parallel(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights const &loops,
+    Weights &degrees,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    ThreadPool &pool,
+    Progress *progress)
+{
+    MoveBuffers buffers;
+    one_level_prune_parallel(graph,
+                             node2com, internals, loops, degrees, gdegrees,
+                             total_weight, resolution, pool, buffers,
+                             progress);
+}
+
+template <typename Index, typename EdgeWeight>
+void one_level_prune_parallel(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights const &loops,
+    Weights &degrees,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    ThreadPool &pool,
+    Nodes const &queued,
+    Progress *progress)
+{
+    MoveBuffers buffers;
+    one_level_prune_parallel(graph,
+                             node2com, internals, loops, degrees, gdegrees,
+                             total_weight, resolution, pool, queued, buffers,
+                             progress);
+}
+
+// Leiden refinement. Every community of node2com is split back into
+// singletons, which are then merged greedily, in node order, into
+// subcommunities that stay well connected to the rest of their community.
+// A node is only merged while it is still alone, and only into a
+// subcommunity of the same community, so communities are never merged and
+// each one can be refined on its own thread.
+// The subcommunity of every node is written to buffers.refined.
+template <typename Index, typename EdgeWeight>
+void refine_partition(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Communities const &communities,
+    Nodes const &node2com,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    ThreadPool &pool,
+    MoveBuffers &buffers)
+{
+    size_t n_nodes = graph.n_nodes;
+    float m = 2 * total_weight;
+
+    Nodes &refined = buffers.refined;
+    Nodes &refined_size = buffers.refined_size;
+    Weights &refined_degrees = buffers.refined_degrees;
+    // weight between a subcommunity and the rest of its community
+    Weights &external = buffers.external;
+    refined.resize(n_nodes);
+    refined_size.assign(n_nodes, 1);
+    refined_degrees.assign(gdegrees.begin(), gdegrees.begin() + n_nodes);
+    external.assign(n_nodes, 0);
+    fit_batches(buffers, pool.size());
+
+    pool.parallel_for_thread(0, communities.size(), [&](size_t thread, size_t com)
+    {
+        DenseWeightMap &neighbor_weight = buffers.thread_neighbor_weight[thread];
+        fit_keys(neighbor_weight, n_nodes);
+
+        NodeRange nodes = communities[com];
+        Weight com_degree = 0;
+        for (Node node : nodes)
+        {
+            refined[node] = node;
+            com_degree += gdegrees[node];
+            for (Index i = graph.indptr[node]; i < graph.indptr[node + 1]; i++)
+            {
+                Node neighbor = graph.indices[i];
+                if (neighbor != node && node2com[neighbor] == com)
+                    external[node] += graph.weight(i);
+            }
+        }
+
+        for (Node node : nodes)
+        {
+            if (refined[node] != node || refined_size[node] != 1)
+                continue;
+
+            Weight node_gdegree = gdegrees[node];
+            if (resolution * external[node] < node_gdegree * (com_degree - node_gdegree) / m)
+                continue;
+
+            neighbor_weight.clear();
+            for (Index i = graph.indptr[node]; i < graph.indptr[node + 1]; i++)
+            {
+                Node neighbor = graph.indices[i];
+                if (neighbor != node && node2com[neighbor] == com)
+                    neighbor_weight.add(refined[neighbor], graph.weight(i));
+            }
+
+            Node best_sub = node;
+            float best_increase = 0;
+            for (Node sub : neighbor_weight.touched)
+            {
+                Weight sub_degree = refined_degrees[sub];
+                if (resolution * external[sub] < sub_degree * (com_degree - sub_degree) / m)
+                    continue;
+
+                float increase = resolution * neighbor_weight.weight[sub];
+                increase -= sub_degree * node_gdegree / m;
+                if (increase > best_increase)
+                {
+                    best_increase = increase;
+                    best_sub = sub;
+                }
+            }
+
+            if (best_sub == node)
+                continue;
+            external[best_sub] += external[node] - 2 * neighbor_weight.weight[best_sub];
+            refined_degrees[best_sub] += node_gdegree;
+            refined_size[best_sub] += 1;
+            refined_size[node] = 0;
+            refined[node] = best_sub;
+        }
+    }, 16);
+}
+
+template <typename Index, typename EdgeWeight>
+Nodes refine_partition(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Communities const &communities,
+    Nodes const &node2com,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    ThreadPool &pool)
+{
+    MoveBuffers buffers;
+    refine_partition(graph, communities, node2com, gdegrees,
+                     total_weight, resolution, pool, buffers);
+    return std::move(buffers.refined);
+}
+
+void renumber(
+    Nodes const &node2com,
+    Communities &communities,
+    Nodes &new_node2com)
+{
+    size_t n_nodes = node2com.size();
+    Nodes &com_index = communities.nodes;
+    std::vector<size_t> &start = communities.start;
+
+    // size of every community, then its new index
+    com_index.assign(n_nodes, 0);
+    for (Node node = 0; node < n_nodes; node++)
+        com_index[node2com[node]]++;
+    start.assign(1, 0);
+    for (Node com = 0; com < n_nodes; com++)
+    {
+        if (com_index[com] <= 0)
+            continue;
+        start.push_back(start.back() + com_index[com]);
+        com_index[com] = start.size() - 2;
+    }
+
+    new_node2com.resize(n_nodes);
+    for (Node node = 0; node < n_nodes; node++)
+        new_node2com[node] = com_index[node2com[node]];
+
+    // members in node order: start[com + 1] is first used as the next
+    // free slot of com, and ends up at the start of com + 1
+    size_t n_communities = start.size() - 1;
+    for (size_t com = n_communities; com > 0; com--)
+        start[com] = start[com - 1];
+    for (Node node = 0; node < n_nodes; node++)
+        com_index[start[new_node2com[node] + 1]++] = node;
+}
+
+template <typename Index, typename EdgeWeight>
+CSRGraph<Index> induced_graph(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Communities const &communities,
+    Nodes const &node2com,
+    ThreadPool &pool,
+    AggregateBuffers<Index> &buffers)
+{
+    size_t new_n_nodes = communities.size();
+    size_t n_threads = pool.size();
+
+    // rows are first built in per-thread buffers, then copied in place
+    // once their lengths are known
+    buffers.rows.resize(n_threads);
+    buffers.thread_indices.resize(n_threads);
+    buffers.thread_weights.resize(n_threads);
+    for (size_t thread = 0; thread < n_threads; thread++)
+    {
+        buffers.thread_indices[thread].clear();
+        buffers.thread_weights[thread].clear();
+    }
+    buffers.row_thread.resize(new_n_nodes);
+    buffers.row_offset.resize(new_n_nodes);
+
+    std::shared_ptr<CSRStorage<Index, Weight>> storage;
+    for (auto &candidate : buffers.graphs)
+    {
+        if (!candidate)
+            candidate = std::make_shared<CSRStorage<Index, Weight>>();
+        if (candidate.use_count() == 1)
+        {
+            storage = candidate;
+            break;
+        }
+    }
+    if (!storage)
+        storage = std::make_shared<CSRStorage<Index, Weight>>();
+    std::vector<Index> &new_indptr = storage->indptr;
+    std::vector<Index> &new_indices = storage->indices;
+    Weights &new_weights = storage->weights;
+    new_indptr.assign(new_n_nodes + 1, 0);
+
+    pool.parallel_for_thread(0, new_n_nodes, [&](size_t thread, size_t i)
+    {
+        DenseWeightMap &row = buffers.rows[thread];
+        if (row.weight.size() < new_n_nodes)
+            row.resize(new_n_nodes);
+
+        for (Node node : communities[i])
+        {
+            for (Index k = graph.indptr[node]; k < graph.indptr[node + 1]; k++)
+            {
+                Node neighbor = graph.indices[k];
+                Weight neighbor_weight = graph.weight(k);
                 if (neighbor == node)
-                    to_insert[neighbor_com] += 2 * neighbor_weight;
+                    row.add(node2com[neighbor], 2 * neighbor_weight);
                 else
-                    to_insert[neighbor_com] += neighbor_weight;
+                    row.add(node2com[neighbor], neighbor_weight);
             }
         }
-        for (auto [com_, weight_] : to_insert)
+
+        std::vector<Index> &indices = buffers.thread_indices[thread];
+        Weights &weights = buffers.thread_weights[thread];
+        buffers.row_thread[i] = thread;
+        buffers.row_offset[i] = indices.size();
+        for (Node com_ : row.touched)
         {
-            new_graph_neighbors[i].push_back(com_);
+            indices.push_back(com_);
             if (com_ == i)
-                new_graph_weights[i].push_back(weight_ / 2);
+                weights.push_back(row.weight[com_] / 2);
             else
-                new_graph_weights[i].push_back(weight_);
+                weights.push_back(row.weight[com_]);
         }
-    }
-    return std::make_tuple(new_graph_neighbors, new_graph_weights, new_n_nodes);
+        new_indptr[i + 1] = row.touched.size();
+        row.clear();
+    }, 16);
+
+    for (size_t i = 0; i < new_n_nodes; i++)
+        new_indptr[i + 1] += new_indptr[i];
+
+    new_indices.resize(new_indptr[new_n_nodes]);
+    new_weights.resize(new_indptr[new_n_nodes]);
+    pool.parallel_for(0, new_n_nodes, [&](size_t i)
+    {
+        size_t thread = buffers.row_thread[i];
+        size_t offset = buffers.row_offset[i];
+        size_t length = new_indptr[i + 1] - new_indptr[i];
+        std::copy_n(buffers.thread_indices[thread].begin() + offset, length,
+                    new_indices.begin() + new_indptr[i]);
+        std::copy_n(buffers.thread_weights[thread].begin() + offset, length,
+                    new_weights.begin() + new_indptr[i]);
+    });
+
+    return make_csr(storage);
+}
+
+template <typename Index, typename EdgeWeight>
+CSRGraph<Index> induced_graph(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Communities const &communities,
+    Nodes const &node2com,
+    ThreadPool &pool)
+{
+    AggregateBuffers<Index> buffers;
+    return induced_graph(graph, communities, node2com, pool, buffers);
+}
+
+template <typename Index, typename EdgeWeight>
+void move_nodes(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights const &loops,
+    Weights &degrees,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    bool prune,
+    ThreadPool &pool,
+    MoveBuffers &buffers,
+    Progress *progress)
+{
+    if (prune && pool.requested() > 1)
+        one_level_prune_parallel(graph,
+                                 node2com, internals, loops, degrees, gdegrees,
+                                 total_weight, resolution, pool, buffers,
+                                 progress);
+    else if (prune)
+        one_level_prune(graph,
+                        node2com, internals, loops, degrees, gdegrees,
+                        total_weight, resolution, buffers, progress);
+    else if (pool.requested() > 1)
+        one_level_parallel(graph,
+                           node2com, internals, loops, degrees, gdegrees,
+                           total_weight, resolution, pool, buffers, progress);
+    else
+        one_level(graph,
+                  node2com, internals, loops, degrees, gdegrees,
+                  total_weight, resolution, buffers, progress);
+}
+
+template <typename Index, typename EdgeWeight>
+void move_nodes(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights const &loops,
+    Weights &degrees,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    bool prune,
+    ThreadPool &pool,
+    Progress *progress)
+{
+    MoveBuffers buffers;
+    move_nodes(graph,
+               node2com, internals, loops, degrees, gdegrees,
+               total_weight, resolution, prune, pool, buffers, progress);
 }
 
 Nodes get_partition(Nodes const &node2com, size_t n_nodes)
@@ -439,213 +1478,647 @@ Nodes get_partition(Nodes const &node2com, size_t n_nodes)
     return partition;
 }
 
-GraphNeighbors generate_dendrogram(
-    py::array_t<int32_t> _indptr,
-    py::array_t<int32_t> _indices,
-    py::array_t<float> _data,
+// What the level loops carry from one level to the next. It is sized by
+// the first level and reused by the next ones, which are never larger:
+// past level 0, the status, the communities and the coarse graphs are
+// rebuilt in place. `renumbered` and the refined_ members are scratch
+// space for full_dendrogram and leiden_dendrogram, and `moves` that of
+// local moving and refinement.
+template <typename Index>
+struct LevelBuffers
+{
+    Nodes node2com;
+    Weights internals;
+    Weights loops;
+    Weights degrees;
+    Weights gdegrees;
+    float total_weight = 0;
+    Communities communities;
+    Nodes renumbered;
+    Communities refined_communities;
+    Nodes refined_node2com;
+    AggregateBuffers<Index> aggregate;
+    MoveBuffers moves;
+
+    size_t bytes() const
+    {
+        return capacity_bytes(node2com) + capacity_bytes(internals) +
+               capacity_bytes(loops) + capacity_bytes(degrees) +
+               capacity_bytes(gdegrees) + communities.bytes() +
+               capacity_bytes(renumbered) + refined_communities.bytes() +
+               capacity_bytes(refined_node2com) + aggregate.bytes() +
+               moves.bytes();
+    }
+};
+
+// Levels above the first one: local moving on the coarse graph and
+// aggregation, until modularity stops improving on `mod`. `graph` should
+// be the only copy of the coarse graph so that its buffer can be reused.
+// Every coarse graph is saved to `checkpoint` if there is one.
+template <typename Index>
+void coarse_levels(
+    CSRGraph<Index> graph,
+    double mod,
     float resolution,
-    bool prune)
+    bool prune,
+    ThreadPool &pool,
+    LevelBuffers<Index> &buffers,
+    GraphNeighbors &partition_list,
+    Progress *progress,
+    Checkpoint *checkpoint = nullptr)
 {
-    auto [graph_neighbors, graph_weights] = get_adj(_indptr, _indices, _data);
+    auto &[node2com, internals, loops, degrees, gdegrees, total_weight,
+           communities, renumbered, refined_communities, refined_node2com,
+           aggregate, moves] = buffers;
+    double new_mod;
+    size_t n_nodes = graph.n_nodes;
 
-    float mod;
-    float new_mod;
+    while (true)
+    {
+        // init_status
+        progress->start_level(n_nodes, graph.n_edges());
+        total_weight = init_status(
+            graph, node2com, internals, loops, degrees, gdegrees);
+        progress->add_time(&LevelStats::init_seconds);
+
+        move_nodes(graph,
+                   node2com, internals, loops, degrees, gdegrees,
+                   total_weight, resolution, prune, pool, moves, progress);
+        new_mod = modularity(internals, degrees, total_weight, resolution);
+        progress->add_time(&LevelStats::move_seconds);
+
+        renumber(node2com, communities, node2com);
+        if (new_mod - mod < 0.0000001)
+        {
+            progress->add_time(&LevelStats::aggregate_seconds);
+            progress->end_level(communities.size(), new_mod, buffers.bytes());
+            break;
+        }
+
+        mod = new_mod;
+        partition_list.push_back(get_partition(node2com, n_nodes));
+        graph = induced_graph(graph, communities, node2com, pool, aggregate);
+        n_nodes = graph.n_nodes;
+        // a level cut short by progress is redone on resume
+        if (checkpoint && !progress->stopped())
+            checkpoint->save(graph, mod, partition_list, Nodes());
+        progress->add_time(&LevelStats::aggregate_seconds);
+        progress->end_level(communities.size(), new_mod, buffers.bytes());
+        if (progress->stopped())
+            break;
+    }
+}
+
+template <typename Index, typename EdgeWeight>
+GraphNeighbors dendrogram(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    float resolution,
+    bool prune,
+    int n_threads,
+    Nodes const &membership,
+    Progress *progress,
+    std::string const &checkpoint_path)
+{
+    ThreadPool pool(resolve_n_threads(n_threads));
+    Progress ignored;
+    if (!progress)
+        progress = &ignored;
+    LevelBuffers<Index> buffers;
+    auto &[node2com, internals, loops, degrees, gdegrees, total_weight,
+           communities, renumbered, refined_communities, refined_node2com,
+           aggregate, moves] = buffers;
+    double new_mod;
 
     GraphNeighbors partition_list;
-    GraphNeighbors communities;
-    size_t n_nodes = graph_neighbors.size();
+    size_t n_nodes = graph.n_nodes;
+
+    // resume above the last level that was checkpointed
+    std::unique_ptr<Checkpoint> checkpoint;
+    if (!checkpoint_path.empty())
+    {
+        checkpoint = std::make_unique<Checkpoint>(
+            checkpoint_path, n_nodes, graph.n_edges(), resolution, prune, false);
+        CSRGraph<Index> coarse;
+        Nodes unused;
+        if (checkpoint->load(coarse, new_mod, partition_list, unused))
+        {
+            coarse_levels(std::move(coarse), new_mod, resolution, prune, pool,
+                          buffers, partition_list, progress, checkpoint.get());
+            checkpoint->finish(!progress->stopped());
+            return partition_list;
+        }
+    }
 
     // init_status
-    auto [node2com,
-          internals,
-          loops,
-          degrees,
-          gdegrees,
-          total_weight] = init_status(graph_neighbors, graph_weights);
+    progress->start_level(n_nodes, graph.n_edges());
+    total_weight = init_status(
+        graph, node2com, internals, loops, degrees, gdegrees);
+    // warm start
+    if (!membership.empty())
+        set_communities(graph, membership,
+                        node2com, internals, loops, degrees, gdegrees, pool,
+                        moves);
+    progress->add_time(&LevelStats::init_seconds);
     // one_level
-    if (prune)
-        one_level_prune(graph_neighbors, graph_weights,
-                        node2com, internals, loops, degrees, gdegrees,
-                        total_weight, resolution);
-    else
-        one_level(graph_neighbors, graph_weights,
-                  node2com, internals, loops, degrees, gdegrees,
-                  total_weight, resolution);
+    move_nodes(graph,
+               node2com, internals, loops, degrees, gdegrees,
+               total_weight, resolution, prune, pool, moves, progress);
 
     // new_mod
     new_mod = modularity(internals, degrees, total_weight, resolution);
+    progress->add_time(&LevelStats::move_seconds);
 
     // renumber
-    std::tie(communities, node2com) = renumber(
-        graph_neighbors, graph_weights, node2com);
+    renumber(node2com, communities, node2com);
     // partition_list
     partition_list.push_back(get_partition(node2com, n_nodes));
 
-    mod = new_mod;
     // induced graph
-    std::tie(graph_neighbors, graph_weights, n_nodes) = induced_graph(
-        graph_neighbors, graph_weights, communities, node2com);
+    CSRGraph<Index> coarse = induced_graph(
+        graph, communities, node2com, pool, aggregate);
+    if (checkpoint && !progress->stopped())
+        checkpoint->save(coarse, new_mod, partition_list, Nodes());
+    progress->add_time(&LevelStats::aggregate_seconds);
+    progress->end_level(communities.size(), new_mod, buffers.bytes());
+    if (!progress->stopped())
+        coarse_levels(std::move(coarse), new_mod, resolution, prune, pool,
+                      buffers, partition_list, progress, checkpoint.get());
+    if (checkpoint)
+        checkpoint->finish(!progress->stopped());
+    return partition_list;
+}
 
-    // init_status
-    std::tie(node2com,
-             internals,
-             loops,
-             degrees,
-             gdegrees,
-             total_weight) = init_status(graph_neighbors, graph_weights);
+template <typename Index>
+GraphNeighbors coarse_dendrogram(
+    CSRGraph<Index> graph,
+    double mod,
+    float resolution,
+    bool prune,
+    int n_threads,
+    Progress *progress)
+{
+    ThreadPool pool(resolve_n_threads(n_threads));
+    Progress ignored;
+    if (!progress)
+        progress = &ignored;
+    LevelBuffers<Index> buffers;
+    GraphNeighbors partition_list;
+    coarse_levels(std::move(graph), mod, resolution, prune, pool,
+                  buffers, partition_list, progress);
+    return partition_list;
+}
 
-    while (true)
+// Final community of every node of the first level
+Nodes flatten_dendrogram(GraphNeighbors const &partition_list)
+{
+    if (partition_list.empty())
+        return Nodes();
+
+    Nodes partition = partition_list[0];
+    for (size_t level = 1; level < partition_list.size(); level++)
     {
-        if (prune)
-        {
-            one_level_prune(graph_neighbors, graph_weights,
-                            node2com, internals, loops, degrees, gdegrees,
-                            total_weight, resolution);
-        }
-        else
-        {
-            one_level(graph_neighbors, graph_weights,
-                      node2com, internals, loops, degrees, gdegrees,
-                      total_weight, resolution);
-        }
-        new_mod = modularity(internals, degrees, total_weight, resolution);
-        if (new_mod - mod < 0.0000001)
+        for (Node &com : partition)
+            com = partition_list[level][com];
+    }
+    return partition;
+}
+
+void check_dendrogram(GraphNeighbors const &partition_list)
+{
+    for (size_t level = 0; level < partition_list.size(); level++)
+    {
+        Node n_communities = std::numeric_limits<Node>::max();
+        if (level + 1 < partition_list.size())
+            n_communities = partition_list[level + 1].size();
+        for (Node com : partition_list[level])
         {
-            break;
+            if (com < 0 || com >= n_communities)
+                throw std::invalid_argument("dendrogram levels do not match");
         }
+    }
+}
 
-        std::tie(communities, node2com) = renumber(
-            graph_neighbors, graph_weights, node2com);
-        mod = new_mod;
-        partition_list.push_back(get_partition(node2com, n_nodes));
-        std::tie(graph_neighbors, graph_weights, n_nodes) = induced_graph(
-            graph_neighbors, graph_weights, communities, node2com);
-        std::tie(node2com,
-                 internals,
-                 loops,
-                 degrees,
-                 gdegrees,
-                 total_weight) = init_status(graph_neighbors, graph_weights);
+void check_merges(Merges const &merges, size_t n_communities)
+{
+    std::vector<char> merged(n_communities, 0);
+    for (auto [from, into] : merges)
+    {
+        if (into < 0 || from >= n_communities || into >= from ||
+            merged[from] || merged[into])
+            throw std::invalid_argument("dendrogram merges do not match");
+        merged[from] = 1;
     }
-    return partition_list;
 }
 
-GraphNeighbors generate_full_dendrogram(
-    py::array_t<int32_t> _indptr,
-    py::array_t<int32_t> _indices,
-    py::array_t<float> _data,
-    float resolution,
-    bool prune)
+Nodes merge_partition(Merges const &merges, size_t n_merges, size_t n_communities)
 {
-    auto [graph_neighbors, graph_weights] = get_adj(_indptr, _indices, _data);
+    // every name points to a smaller one it was merged into, so resolving
+    // the names in increasing order finds the union of each in one step
+    Nodes partition(n_communities);
+    for (Node com = 0; com < n_communities; com++)
+        partition[com] = com;
+    for (size_t k = 0; k < n_merges; k++)
+        partition[merges[k].first] = merges[k].second;
+    Node n_left = 0;
+    for (Node com = 0; com < n_communities; com++)
+        partition[com] = partition[com] == com ? n_left++
+                                               : partition[partition[com]];
+    return partition;
+}
 
-    float mod;
-    float new_mod;
+// Incremental version of dendrogram for a graph that changed since
+// `previous` was computed. Level 0 starts from the previous final
+// partition (nodes added since then start alone), and only the nodes in
+// `changed` are queued for pruned local moving; the queue then spreads to
+// the neighbors of the nodes that move. The coarse levels are rebuilt as
+// usual, they only span the final communities.
+template <typename Index, typename EdgeWeight>
+GraphNeighbors incremental_dendrogram(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    GraphNeighbors const &previous,
+    Nodes const &changed,
+    float resolution,
+    int n_threads,
+    Progress *progress)
+{
+    ThreadPool pool(resolve_n_threads(n_threads));
+    Progress ignored;
+    if (!progress)
+        progress = &ignored;
+    LevelBuffers<Index> buffers;
+    auto &[node2com, internals, loops, degrees, gdegrees, total_weight,
+           communities, renumbered, refined_communities, refined_node2com,
+           aggregate, moves] = buffers;
+    double new_mod;
 
     GraphNeighbors partition_list;
-    GraphNeighbors communities;
-    size_t n_nodes = graph_neighbors.size();
+    size_t n_nodes = graph.n_nodes;
+
+    progress->start_level(n_nodes, graph.n_edges());
+    check_dendrogram(previous);
+    if (!previous.empty() && previous[0].size() > n_nodes)
+        throw std::invalid_argument("the graph has fewer nodes than the dendrogram");
+    Nodes membership = flatten_dendrogram(previous);
+    Nodes queued = changed;
+    size_t n_previous = membership.size();
+    // the new nodes start alone, under their own id
+    for (Node com : membership)
+    {
+        if (com >= Node(n_previous))
+            throw std::invalid_argument("the dendrogram has more communities than nodes");
+    }
+    for (Node node = n_previous; node < n_nodes; node++)
+    {
+        membership.push_back(node);
+        queued.push_back(node);
+    }
+    renumber(membership, communities, membership);
 
     // init_status
-    auto [node2com,
-          internals,
-          loops,
-          degrees,
-          gdegrees,
-          total_weight] = init_status(graph_neighbors, graph_weights);
+    total_weight = init_status(
+        graph, node2com, internals, loops, degrees, gdegrees);
+    set_communities(graph, membership,
+                    node2com, internals, loops, degrees, gdegrees, pool, moves);
+    progress->add_time(&LevelStats::init_seconds);
 
     // one_level
-    if (prune)
-    {
-        one_level_prune(graph_neighbors, graph_weights,
+    if (pool.requested() > 1)
+        one_level_prune_parallel(graph,
+                                 node2com, internals, loops, degrees, gdegrees,
+                                 total_weight, resolution, pool, queued, moves,
+                                 progress);
+    else
+        one_level_prune(graph,
                         node2com, internals, loops, degrees, gdegrees,
-                        total_weight, resolution);
+                        total_weight, resolution, queued, moves, progress);
+    new_mod = modularity(internals, degrees, total_weight, resolution);
+    progress->add_time(&LevelStats::move_seconds);
+
+    renumber(node2com, communities, node2com);
+    partition_list.push_back(get_partition(node2com, n_nodes));
+    CSRGraph<Index> coarse = induced_graph(
+        graph, communities, node2com, pool, aggregate);
+    progress->add_time(&LevelStats::aggregate_seconds);
+    progress->end_level(communities.size(), new_mod, buffers.bytes());
+    if (!progress->stopped())
+        coarse_levels(std::move(coarse), new_mod, resolution, false, pool,
+                      buffers, partition_list, progress);
+    return partition_list;
+}
+
+// One level of leiden_dendrogram, starting from `membership` when it is
+// not empty. `mod` is the modularity of the level below; the first level
+// compares against its starting partition instead. Returns whether there
+// is a next level, in which case `coarse` and `membership` are set for it
+// (`coarse` may be the graph of this level).
+template <typename Index, typename EdgeWeight>
+bool leiden_level(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &membership,
+    double &mod,
+    float resolution,
+    bool prune,
+    ThreadPool &pool,
+    LevelBuffers<Index> &buffers,
+    GraphNeighbors &partition_list,
+    Progress *progress,
+    CSRGraph<Index> &coarse)
+{
+    auto &[node2com, internals, loops, degrees, gdegrees, total_weight,
+           communities, renumbered, refined_communities, refined_node2com,
+           aggregate, moves] = buffers;
+    size_t n_nodes = graph.n_nodes;
+
+    // init_status
+    progress->start_level(n_nodes, graph.n_edges());
+    total_weight = init_status(
+        graph, node2com, internals, loops, degrees, gdegrees);
+    if (!membership.empty())
+        set_communities(graph, membership,
+                        node2com, internals, loops, degrees, gdegrees, pool,
+                        moves);
+    if (partition_list.empty())
+        mod = modularity(internals, degrees, total_weight, resolution);
+    progress->add_time(&LevelStats::init_seconds);
+
+    // once stopped, the last level only maps the refined subcommunities
+    // back to their communities
+    if (!progress->stopped())
+        move_nodes(graph,
+                   node2com, internals, loops, degrees, gdegrees,
+                   total_weight, resolution, prune, pool, moves, progress);
+    double new_mod = modularity(internals, degrees, total_weight, resolution);
+    progress->add_time(&LevelStats::move_seconds);
+
+    // renumbered is the community of every node
+    renumber(node2com, communities, renumbered);
+    if (communities.size() == n_nodes)
+    {
+        if (partition_list.empty())
+            partition_list.push_back(get_partition(renumbered, n_nodes));
+        progress->add_time(&LevelStats::aggregate_seconds);
+        progress->end_level(communities.size(), new_mod, buffers.bytes());
+        return false;
     }
-    else
+    if (new_mod - mod < 0.0000001 || progress->stopped())
     {
-        one_level(graph_neighbors, graph_weights,
-                  node2com, internals, loops, degrees, gdegrees,
-                  total_weight, resolution);
+        partition_list.push_back(get_partition(renumbered, n_nodes));
+        progress->add_time(&LevelStats::aggregate_seconds);
+        progress->end_level(communities.size(), new_mod, buffers.bytes());
+        return false;
+    }
+
+    // refine
+    refine_partition(graph, communities, renumbered, gdegrees,
+                     total_weight, resolution, pool, moves);
+    Nodes const &refined = moves.refined;
+    renumber(refined, refined_communities, refined_node2com);
+    progress->add_time(&LevelStats::refine_seconds);
+
+    // nothing was merged by the refinement: aggregate the communities
+    // themselves so that the graph still shrinks
+    if (refined_communities.size() == n_nodes)
+    {
+        refined_communities = communities;
+        refined_node2com = renumbered;
+    }
+
+    membership.resize(refined_communities.size());
+    for (Node node = 0; node < n_nodes; node++)
+        membership[refined_node2com[node]] = renumbered[node];
+
+    mod = new_mod;
+    partition_list.push_back(get_partition(refined_node2com, n_nodes));
+    coarse = induced_graph(
+        graph, refined_communities, refined_node2com, pool, aggregate);
+    progress->add_time(&LevelStats::aggregate_seconds);
+    progress->end_level(communities.size(), new_mod, buffers.bytes());
+    return true;
+}
+
+// Same level loop as dendrogram, with a refinement step between local
+// moving and aggregation. The coarse graph is built from the refined
+// communities, and its nodes start out in the community that local moving
+// found for them rather than as singletons.
+template <typename Index, typename EdgeWeight>
+GraphNeighbors leiden_dendrogram(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    float resolution,
+    bool prune,
+    int n_threads,
+    Nodes const &membership,
+    Progress *progress,
+    std::string const &checkpoint_path)
+{
+    ThreadPool pool(resolve_n_threads(n_threads));
+    Progress ignored;
+    if (!progress)
+        progress = &ignored;
+    LevelBuffers<Index> buffers;
+
+    GraphNeighbors partition_list;
+    Nodes level_membership = membership;
+    CSRGraph<Index> coarse;
+    double mod = 0;
+    // resume above the last level that was checkpointed
+    std::unique_ptr<Checkpoint> checkpoint;
+    bool resumed = false;
+    if (!checkpoint_path.empty())
+    {
+        checkpoint = std::make_unique<Checkpoint>(
+            checkpoint_path, graph.n_nodes, graph.n_edges(), resolution,
+            prune, true);
+        resumed = checkpoint->load(
+            coarse, mod, partition_list, level_membership);
     }
+    bool more = resumed ||
+                leiden_level(graph, level_membership, mod, resolution, prune,
+                             pool, buffers, partition_list, progress, coarse);
+    while (more)
+    {
+        if (checkpoint && !resumed)
+            checkpoint->save(coarse, mod, partition_list, level_membership);
+        resumed = false;
+        more = leiden_level(coarse, level_membership, mod, resolution, prune,
+                            pool, buffers, partition_list, progress, coarse);
+    }
+    if (checkpoint)
+        checkpoint->finish(!progress->stopped());
+    return partition_list;
+}
+
+template <typename Index, typename EdgeWeight>
+GraphNeighbors full_dendrogram(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    float resolution,
+    bool prune,
+    int n_threads,
+    Merges &merges,
+    Progress *progress)
+{
+    ThreadPool pool(resolve_n_threads(n_threads));
+    Progress ignored;
+    if (!progress)
+        progress = &ignored;
+    LevelBuffers<Index> buffers;
+    auto &[node2com, internals, loops, degrees, gdegrees, total_weight,
+           communities, renumbered, refined_communities, refined_node2com,
+           aggregate, moves] = buffers;
+    double mod;
+    double new_mod;
+
+    GraphNeighbors partition_list;
+    size_t n_nodes = graph.n_nodes;
+
+    // init_status
+    progress->start_level(n_nodes, graph.n_edges());
+    total_weight = init_status(
+        graph, node2com, internals, loops, degrees, gdegrees);
+    progress->add_time(&LevelStats::init_seconds);
+
+    // one_level
+    move_nodes(graph,
+               node2com, internals, loops, degrees, gdegrees,
+               total_weight, resolution, prune, pool, moves, progress);
     // new_mod
     new_mod = modularity(internals, degrees, total_weight, resolution);
+    progress->add_time(&LevelStats::move_seconds);
 
     // renumber
-    std::tie(communities, node2com) = renumber(
-        graph_neighbors, graph_weights, node2com);
+    renumber(node2com, communities, node2com);
     // partition_list
     partition_list.push_back(get_partition(node2com, n_nodes));
 
     mod = new_mod;
     // induced graph
-    std::tie(graph_neighbors, graph_weights, n_nodes) = induced_graph(
-        graph_neighbors, graph_weights, communities, node2com);
-
-    // init_status
-    std::tie(node2com,
-             internals,
-             loops,
-             degrees,
-             gdegrees,
-             total_weight) = init_status(graph_neighbors, graph_weights);
+    CSRGraph<Index> coarse = induced_graph(
+        graph, communities, node2com, pool, aggregate);
+    n_nodes = coarse.n_nodes;
+    progress->add_time(&LevelStats::aggregate_seconds);
+    progress->end_level(communities.size(), new_mod, buffers.bytes());
+    if (progress->stopped())
+        return partition_list;
 
     while (true)
     {
-        if (prune)
-        {
-            one_level_prune(graph_neighbors, graph_weights,
-                            node2com, internals, loops, degrees, gdegrees,
-                            total_weight, resolution);
-        }
-        else
-        {
-            one_level(graph_neighbors, graph_weights,
-                      node2com, internals, loops, degrees, gdegrees,
-                      total_weight, resolution);
-        }
+        // init_status
+        progress->start_level(n_nodes, coarse.n_edges());
+        total_weight = init_status(
+            coarse, node2com, internals, loops, degrees, gdegrees);
+        progress->add_time(&LevelStats::init_seconds);
+
+        move_nodes(coarse,
+                   node2com, internals, loops, degrees, gdegrees,
+                   total_weight, resolution, prune, pool, moves, progress);
         new_mod = modularity(internals, degrees, total_weight, resolution);
-        if (new_mod - mod < 0.0000001)
+        progress->add_time(&LevelStats::move_seconds);
+
+        // moves too small to make a level of their own are still kept
+        // when there are some, as they come before any merge
+        renumber(node2com, communities, renumbered);
+        bool converged = new_mod - mod < 0.0000001;
+        if (converged && communities.size() == n_nodes)
         {
+            progress->add_time(&LevelStats::aggregate_seconds);
+            progress->end_level(communities.size(), new_mod, buffers.bytes());
             break;
         }
 
-        std::tie(communities, node2com) = renumber(
-            graph_neighbors, graph_weights, node2com);
+        node2com.swap(renumbered);
         mod = new_mod;
         partition_list.push_back(get_partition(node2com, n_nodes));
-        std::tie(graph_neighbors, graph_weights, n_nodes) = induced_graph(
-            graph_neighbors, graph_weights, communities, node2com);
-        std::tie(node2com,
-                 internals,
-                 loops,
-                 degrees,
-                 gdegrees,
-                 total_weight) = init_status(graph_neighbors, graph_weights);
-    }
-
-    size_t node2com_size = node2com.size();
-    while (true)
-    {
-        // one iteration
-        one_level_each(graph_neighbors, graph_weights,
-                       node2com, internals, loops, degrees, gdegrees,
-                       total_weight, resolution);
-        std::tie(communities, node2com) = renumber(
-            graph_neighbors, graph_weights, node2com);
-        partition_list.push_back(get_partition(node2com, n_nodes));
-        std::tie(graph_neighbors, graph_weights, n_nodes) = induced_graph(
-            graph_neighbors, graph_weights, communities, node2com);
-        std::tie(node2com,
-                 internals,
-                 loops,
-                 degrees,
-                 gdegrees,
-                 total_weight) = init_status(graph_neighbors, graph_weights);
-        if (node2com.size() == node2com_size)
+        coarse = induced_graph(coarse, communities, node2com, pool, aggregate);
+        n_nodes = coarse.n_nodes;
+        progress->add_time(&LevelStats::aggregate_seconds);
+        progress->end_level(communities.size(), new_mod, buffers.bytes());
+        if (progress->stopped())
+            return partition_list;
+        if (converged)
             break;
-
-        node2com_size = node2com.size();
     }
 
+    // merge phase
+    total_weight = init_status(
+        coarse, node2com, internals, loops, degrees, gdegrees);
+    merge_levels(coarse, internals, degrees, total_weight, resolution, mod,
+                 merges, progress, buffers.bytes());
+
     return partition_list;
 }
+
+#define INSTANTIATE_GRAPH(Index, EdgeWeight)                                \
+    template CSRGraph<Index, EdgeWeight> make_csr(                          \
+        std::vector<Index> &&, std::vector<Index> &&,                       \
+        std::vector<EdgeWeight> &&);                                        \
+    template std::tuple<Nodes, Weights, Weights, Weights, Weights, float>   \
+        init_status(CSRGraph<Index, EdgeWeight> const &);                   \
+    template float init_status(                                             \
+        CSRGraph<Index, EdgeWeight> const &, Nodes &, Weights &, Weights &, \
+        Weights &, Weights &);                                              \
+    template void neighcom(                                                 \
+        CSRGraph<Index, EdgeWeight> const &, Nodes const &, Node,           \
+        DenseWeightMap &);                                                  \
+    template double partition_modularity(                                   \
+        CSRGraph<Index, EdgeWeight> const &, Nodes const &, float);         \
+    template void one_level(                                                \
+        CSRGraph<Index, EdgeWeight> const &, Nodes &, Weights &,            \
+        Weights const &, Weights &, Weights const &, float, float,          \
+        Progress *);                                                        \
+    template void one_level_parallel(                                       \
+        CSRGraph<Index, EdgeWeight> const &, Nodes &, Weights &,            \
+        Weights const &, Weights &, Weights const &, float, float,          \
+        ThreadPool &, Progress *);                                          \
+    template void one_level_prune_parallel(                                 \
+        CSRGraph<Index, EdgeWeight> const &, Nodes &, Weights &,            \
+        Weights const &, Weights &, Weights const &, float, float,          \
+        ThreadPool &, Progress *);                                          \
+    template void one_level_prune_parallel(                                 \
+        CSRGraph<Index, EdgeWeight> const &, Nodes &, Weights &,            \
+        Weights const &, Weights &, Weights const &, float, float,          \
+        ThreadPool &, Nodes const &, Progress *);                           \
+    template void one_level_prune(                                          \
+        CSRGraph<Index, EdgeWeight> const &, Nodes &, Weights &,            \
+        Weights const &, Weights &, Weights const &, float, float,          \
+        Progress *);                                                        \
+    template void one_level_prune(                                          \
+        CSRGraph<Index, EdgeWeight> const &, Nodes &, Weights &,            \
+        Weights const &, Weights &, Weights const &, float, float,          \
+        Nodes const &, Progress *);                                         \
+    template Nodes refine_partition(                                        \
+        CSRGraph<Index, EdgeWeight> const &, Communities const &,           \
+        Nodes const &, Weights const &, float, float, ThreadPool &);        \
+    template CSRGraph<Index> induced_graph(                                 \
+        CSRGraph<Index, EdgeWeight> const &, Communities const &,           \
+        Nodes const &, ThreadPool &, AggregateBuffers<Index> &);            \
+    template CSRGraph<Index> induced_graph(                                 \
+        CSRGraph<Index, EdgeWeight> const &, Communities const &,           \
+        Nodes const &, ThreadPool &);                                       \
+    template void move_nodes(                                               \
+        CSRGraph<Index, EdgeWeight> const &, Nodes &, Weights &,            \
+        Weights const &, Weights &, Weights const &, float, float,          \
+        bool, ThreadPool &, Progress *);                                    \
+    template GraphNeighbors dendrogram(                                     \
+        CSRGraph<Index, EdgeWeight> const &, float, bool, int,              \
+        Nodes const &, Progress *, std::string const &);                    \
+    template GraphNeighbors leiden_dendrogram(                              \
+        CSRGraph<Index, EdgeWeight> const &, float, bool, int,              \
+        Nodes const &, Progress *, std::string const &);                    \
+    template GraphNeighbors incremental_dendrogram(                         \
+        CSRGraph<Index, EdgeWeight> const &, GraphNeighbors const &,        \
+        Nodes const &, float, int, Progress *);                             \
+    template GraphNeighbors full_dendrogram(                                \
+        CSRGraph<Index, EdgeWeight> const &, float, bool, int, Merges &,    \
+        Progress *);
+
+#define INSTANTIATE_INDEX(Index)                                            \
+    INSTANTIATE_GRAPH(Index, float)                                         \
+    INSTANTIATE_GRAPH(Index, double)                                        \
+    INSTANTIATE_GRAPH(Index, Unweighted)                                    \
+    template void merge_levels(                                             \
+        CSRGraph<Index> const &, Weights &, Weights &, float, float,        \
+        double, Merges &, Progress *, size_t);                              \
+    template GraphNeighbors coarse_dendrogram(                              \
+        CSRGraph<Index>, double, float, bool, int, Progress *);
+
+INSTANTIATE_INDEX(int32_t)
+INSTANTIATE_INDEX(int64_t)
@@ -1,93 +1,480 @@
+#pragma once
 #include <stdlib.h>
-#include <pybind11/pybind11.h>
-#include <pybind11/numpy.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "parallel.hpp"
+#include "progress.hpp"
 
-namespace py = pybind11;
 using Node = int64_t;
 using Nodes = std::vector<Node>;
 using GraphNeighbors = std::vector<Nodes>;
+using Merges = std::vector<std::pair<Node, Node>>;
 using Weight = float;
 using Weights = std::vector<Weight>;
-using GraphWeights = std::vector<Weights>;
 using WeightMap = std::unordered_map<Node, float>;
 
+// Edge weight type of graphs without a weights array, where every edge
+// weighs 1
+struct Unweighted
+{
+};
+
+// Graph in compressed sparse row form. The buffers are either borrowed
+// from numpy (get_adj) or owned by `storage` (induced_graph); in both cases
+// `storage` keeps them alive for as long as a copy of the graph exists.
+// EdgeWeight is the element type of `weights`: float, double, or
+// Unweighted, in which case there is no array and weight() is always 1.
+// Input graphs come in any of them; coarse graphs are always float, and so
+// are the status vectors (Weights) of every graph, double ones included.
+template <typename Index, typename EdgeWeight = Weight>
+struct CSRGraph
+{
+    size_t n_nodes = 0;
+    Index const *indptr = nullptr;
+    Index const *indices = nullptr;
+    EdgeWeight const *weights = nullptr;
+    std::shared_ptr<void> storage;
+
+    size_t n_edges() const { return n_nodes ? indptr[n_nodes] : 0; }
+
+    auto weight(size_t i) const
+    {
+        if constexpr (std::is_same_v<EdgeWeight, Unweighted>)
+            return Weight(1);
+        else
+            return weights[i];
+    }
+};
+
+// Memory held by a vector
+template <typename T>
+size_t capacity_bytes(std::vector<T> const &values)
+{
+    return values.capacity() * sizeof(T);
+}
+
+// Map from community to accumulated weight backed by a dense array, for
+// callers that fill and clear it many times over the same set of keys.
+// `touched` lists the keys in first-insertion order, and `gains` is
+// scratch space for scoring them.
+struct DenseWeightMap
+{
+    Weights weight;
+    std::vector<char> seen;
+    Nodes touched;
+    Weights gains;
+
+    void resize(size_t n_keys)
+    {
+        weight.assign(n_keys, 0);
+        seen.assign(n_keys, 0);
+        touched.clear();
+    }
+
+    void add(Node key, Weight value)
+    {
+        if (!seen[key])
+        {
+            seen[key] = 1;
+            touched.push_back(key);
+        }
+        weight[key] += value;
+    }
+
+    void clear()
+    {
+        for (Node key : touched)
+        {
+            weight[key] = 0;
+            seen[key] = 0;
+        }
+        touched.clear();
+    }
+
+    size_t bytes() const
+    {
+        return capacity_bytes(weight) + capacity_bytes(seen) +
+               capacity_bytes(touched) + capacity_bytes(gains);
+    }
+};
+
+// Buffers of a graph built in memory (induced_graph, make_csr)
+template <typename Index, typename EdgeWeight>
+struct CSRStorage
+{
+    std::vector<Index> indptr;
+    std::vector<Index> indices;
+    std::vector<EdgeWeight> weights;
+
+    size_t bytes() const
+    {
+        return capacity_bytes(indptr) + capacity_bytes(indices) +
+               capacity_bytes(weights);
+    }
+};
+
+// Nodes of a community, as a range over Communities::nodes
+struct NodeRange
+{
+    Node const *first;
+    Node const *last;
+
+    Node const *begin() const { return first; }
+    Node const *end() const { return last; }
+    size_t size() const { return last - first; }
+};
+
+// Members of every community in a single array, in node order: community
+// `com` holds nodes[start[com]] to nodes[start[com + 1]]
+struct Communities
+{
+    Nodes nodes;
+    std::vector<size_t> start;
+
+    size_t size() const { return start.empty() ? 0 : start.size() - 1; }
+
+    NodeRange operator[](size_t com) const
+    {
+        return {nodes.data() + start[com], nodes.data() + start[com + 1]};
+    }
+
+    size_t bytes() const
+    {
+        return capacity_bytes(nodes) + capacity_bytes(start);
+    }
+};
+
+// Scratch space of induced_graph, for callers that aggregate one graph
+// after the other. The coarse graphs are built in `graphs`, in a buffer
+// that no graph still refers to: as long as the caller only keeps the
+// graph it is aggregating, the two buffers take turns.
+template <typename Index>
+struct AggregateBuffers
+{
+    std::vector<DenseWeightMap> rows;
+    std::vector<std::vector<Index>> thread_indices;
+    std::vector<Weights> thread_weights;
+    std::vector<size_t> row_thread;
+    std::vector<size_t> row_offset;
+    std::shared_ptr<CSRStorage<Index, Weight>> graphs[2];
+
+    size_t bytes() const
+    {
+        size_t total = capacity_bytes(row_thread) + capacity_bytes(row_offset);
+        for (DenseWeightMap const &row : rows)
+            total += row.bytes();
+        for (size_t thread = 0; thread < thread_indices.size(); thread++)
+            total += capacity_bytes(thread_indices[thread]) +
+                     capacity_bytes(thread_weights[thread]);
+        for (auto const &graph : graphs)
+        {
+            if (graph)
+                total += graph->bytes();
+        }
+        return total;
+    }
+};
+
+template <typename Index, typename EdgeWeight>
+CSRGraph<Index, EdgeWeight> make_csr(
+    std::shared_ptr<CSRStorage<Index, EdgeWeight>> storage);
+
+template <typename Index, typename EdgeWeight>
+CSRGraph<Index, EdgeWeight> make_csr(
+    std::vector<Index> &&indptr,
+    std::vector<Index> &&indices,
+    std::vector<EdgeWeight> &&weights);
+
+template <typename Index, typename EdgeWeight>
 std::tuple<Nodes, Weights, Weights, Weights, Weights, float> init_status(
-    GraphNeighbors const &graph_neighbors,
-    GraphWeights const &graph_weights);
+    CSRGraph<Index, EdgeWeight> const &graph);
 
-std::tuple<GraphNeighbors, GraphWeights> get_adj(
-    py::array_t<int64_t> _indptr,
-    py::array_t<int64_t> _indices,
-    py::array_t<float> _data);
+// Same, filling the given vectors so that their capacity is reused.
+// Returns the total weight. Only that total is summed in double; every
+// per-node sum is rounded to float as it grows, whatever EdgeWeight is.
+template <typename Index, typename EdgeWeight>
+float init_status(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights &loops,
+    Weights &degrees,
+    Weights &gdegrees);
 
-float modularity(
+double modularity(
     Weights const &internals,
     Weights const &degrees,
     float total_weight,
     float resolution);
 
-WeightMap neighcom(
-    GraphNeighbors const &graph_neighbors,
-    GraphWeights const &graph_weights,
+// Modularity of `partition`, the community of every node in [0, n_nodes)
+template <typename Index, typename EdgeWeight>
+double partition_modularity(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes const &partition,
+    float resolution);
+
+template <typename Index, typename EdgeWeight>
+void neighcom(
+    CSRGraph<Index, EdgeWeight> const &graph,
     Nodes const &node2com,
-    Node node);
+    Node node,
+    DenseWeightMap &neighbor_weight);
+
+// Neighbor community of the node whose weights neighcom gathered in
+// `neighbor_weight` with the largest modularity gain, or `node_com` if none
+// beats `best_increase`, which is updated to the gain of the result.
+// `degrees` may still count the node in its own community, in which case
+// `own_degree` is what is left without it.
+Node best_community(
+    DenseWeightMap &neighbor_weight,
+    Weights const &degrees,
+    Node node_com,
+    Weight own_degree,
+    Weight node_gdegree,
+    float resolution,
+    float m,
+    float &best_increase);
 
+template <typename Index, typename EdgeWeight>
 void one_level(
-    GraphNeighbors const &graph_neighbors,
-    GraphWeights const &graph_weights,
+    CSRGraph<Index, EdgeWeight> const &graph,
     Nodes &node2com,
     Weights &internals,
     Weights const &loops,
     Weights &degrees,
     Weights const &gdegrees,
     float total_weight,
-    float resolution);
+    float resolution,
+    Progress *progress = nullptr);
 
+template <typename Index, typename EdgeWeight>
+void one_level_parallel(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights const &loops,
+    Weights &degrees,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    ThreadPool &pool,
+    Progress *progress = nullptr);
+
+template <typename Index, typename EdgeWeight>
 void one_level_prune(
-    GraphNeighbors const &graph_neighbors,
-    GraphWeights const &graph_weights,
+    CSRGraph<Index, EdgeWeight> const &graph,
     Nodes &node2com,
     Weights &internals,
     Weights const &loops,
     Weights &degrees,
     Weights const &gdegrees,
     float total_weight,
-    float resolution);
+    float resolution,
+    Progress *progress = nullptr);
 
-void one_level_each(
-    GraphNeighbors const &graph_neighbors,
-    GraphWeights const &graph_weights,
+template <typename Index, typename EdgeWeight>
+void one_level_prune(
+    CSRGraph<Index, EdgeWeight> const &graph,
     Nodes &node2com,
     Weights &internals,
     Weights const &loops,
     Weights &degrees,
     Weights const &gdegrees,
     float total_weight,
-    float resolution);
+    float resolution,
+    Nodes const &queued,
+    Progress *progress = nullptr);
+
+template <typename Index, typename EdgeWeight>
+void one_level_prune_parallel(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights const &loops,
+    Weights &degrees,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    ThreadPool &pool,
+    Progress *progress = nullptr);
+
+template <typename Index, typename EdgeWeight>
+void one_level_prune_parallel(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights const &loops,
+    Weights &degrees,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    ThreadPool &pool,
+    Nodes const &queued,
+    Progress *progress = nullptr);
+
+// Agglomerative tail of full_dendrogram: from the singletons of `graph`,
+// merges the linked pair of communities with the largest modularity gain,
+// even a negative one, until no two communities are linked, and appends
+// each merge to `merges` (see check_merges). The gains of all linked pairs
+// are kept in a heap whose stale entries are skipped, and the community
+// with fewer links is folded into the other, so no merge rebuilds the
+// graph or writes a level. `internals` and `degrees` come from init_status
+// and are updated; `mod` is the modularity of the singletons.
+template <typename Index>
+void merge_levels(
+    CSRGraph<Index> const &graph,
+    Weights &internals,
+    Weights &degrees,
+    float total_weight,
+    float resolution,
+    double mod,
+    Merges &merges,
+    Progress *progress,
+    size_t buffer_bytes);
 
-std::tuple<GraphNeighbors, Nodes> renumber(
-    GraphNeighbors const &graph_neighbors,
-    GraphWeights const &graph_weights,
-    Nodes const &node2com);
+template <typename Index, typename EdgeWeight>
+Nodes refine_partition(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Communities const &communities,
+    Nodes const &node2com,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    ThreadPool &pool);
 
-std::tuple<GraphNeighbors, GraphWeights, size_t> induced_graph(
-    GraphNeighbors const &graph_neighbors,
-    GraphWeights const &graph_weights,
-    GraphNeighbors const &communities,
-    Nodes const &node2com);
+// Numbers the non-empty communities of node2com from 0, keeping the order
+// of their old ids, writing the new community of every node to
+// new_node2com (which may be node2com itself) and the members of every
+// community, in node order, to `communities`. No memory is allocated once
+// the outputs are large enough.
+void renumber(
+    Nodes const &node2com,
+    Communities &communities,
+    Nodes &new_node2com);
+
+template <typename Index, typename EdgeWeight>
+CSRGraph<Index> induced_graph(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Communities const &communities,
+    Nodes const &node2com,
+    ThreadPool &pool,
+    AggregateBuffers<Index> &buffers);
+
+template <typename Index, typename EdgeWeight>
+CSRGraph<Index> induced_graph(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Communities const &communities,
+    Nodes const &node2com,
+    ThreadPool &pool);
+
+// Local moving of one level: the colored batches of one_level_parallel
+// when pool.requested() is above 1, else the serial passes, pruned or
+// not. The two find different partitions, so the results of n_threads = 1
+// and n_threads > 1 differ, but those of any two counts above 1 do not.
+template <typename Index, typename EdgeWeight>
+void move_nodes(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes &node2com,
+    Weights &internals,
+    Weights const &loops,
+    Weights &degrees,
+    Weights const &gdegrees,
+    float total_weight,
+    float resolution,
+    bool prune,
+    ThreadPool &pool,
+    Progress *progress = nullptr);
 
 Nodes get_partition(Nodes const &node2com, size_t n_nodes);
 
-GraphNeighbors generate_dendrogram(
-    py::array_t<int32_t> _indptr,
-    py::array_t<int32_t> _indices,
-    py::array_t<float> _data,
+Nodes flatten_dendrogram(GraphNeighbors const &partition_list);
+
+// Throws std::invalid_argument unless every community of a level is a
+// node of the next one; those of the last level must not be negative
+void check_dendrogram(GraphNeighbors const &partition_list);
+
+// The merge tail of full_dendrogram, which stands for one level per merge
+// above the last level of its dendrogram. That level has n_communities
+// communities, named 0 to n_communities - 1. A merge (from, into) folds
+// community `from` into `into`, and the union keeps the smaller name, so
+// into < from. The partition after some of the merges numbers the
+// communities left by ascending name, that is by their first community of
+// the last level.
+
+// Throws std::invalid_argument unless every merge joins two communities
+// that are still there, in (larger name, smaller name) order
+void check_merges(Merges const &merges, size_t n_communities);
+
+// Community of each of the n_communities after the first n_merges merges
+Nodes merge_partition(Merges const &merges, size_t n_merges, size_t n_communities);
+
+// With a checkpoint_path, the state of the run is saved there at every
+// level boundary (see Checkpoint) and a run finding a checkpoint resumes
+// from it; the progress of the levels it skips is not reported again. A
+// level that progress stopped during local moving is not saved, so that
+// it is redone in full. The checkpoint is deleted once the run completes.
+// A path must only be used by one run: a different graph or settings are
+// refused, but a different node order or warm start cannot be told apart.
+template <typename Index, typename EdgeWeight>
+GraphNeighbors dendrogram(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    float resolution,
+    bool prune,
+    int n_threads,
+    Nodes const &membership,
+    Progress *progress = nullptr,
+    std::string const &checkpoint_path = std::string());
+
+// Levels above a first one that was computed elsewhere: `graph` is its
+// coarse graph and `mod` its modularity. Stops as soon as a level does not
+// improve on `mod`, so the result may have no level at all.
+template <typename Index>
+GraphNeighbors coarse_dendrogram(
+    CSRGraph<Index> graph,
+    double mod,
+    float resolution,
+    bool prune,
+    int n_threads,
+    Progress *progress = nullptr);
+
+template <typename Index, typename EdgeWeight>
+GraphNeighbors leiden_dendrogram(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    float resolution,
+    bool prune,
+    int n_threads,
+    Nodes const &membership,
+    Progress *progress = nullptr,
+    std::string const &checkpoint_path = std::string());
+
+template <typename Index, typename EdgeWeight>
+GraphNeighbors incremental_dendrogram(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    GraphNeighbors const &previous,
+    Nodes const &changed,
     float resolution,
-    bool prune);
+    int n_threads,
+    Progress *progress = nullptr);
 
-GraphNeighbors generate_full_dendrogram(
-    py::array_t<int32_t> _indptr,
-    py::array_t<int32_t> _indices,
-    py::array_t<float> _data,
+// Dendrogram that goes on past convergence down to as few communities as
+// the graph allows. Local moving runs as in dendrogram() until a level no
+// longer improves modularity; moves too small to stop it still make a
+// level of their own. From there on, the best linked pair of communities
+// is merged at every step (see merge_levels), and those merges are
+// returned in `merges` rather than as levels: the run ends on the last
+// merge, with no level that leaves the communities unchanged.
+template <typename Index, typename EdgeWeight>
+GraphNeighbors full_dendrogram(
+    CSRGraph<Index, EdgeWeight> const &graph,
     float resolution,
-    bool prune);
\ No newline at end of file
+    bool prune,
+    int n_threads,
+    Merges &merges,
+    Progress *progress = nullptr);
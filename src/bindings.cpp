@@ -1,19 +1,142 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
-#include "algorithm.hpp"
+#include "pyapi.hpp"
 
 namespace py = pybind11;
 
 PYBIND11_MODULE(_louvaincpp, m)
 {
-    m.def("get_adj", &get_adj);
-    m.def("init_status", &init_status);
-    m.def("neighcom", &neighcom);
+    py::class_<CSRGraph<int64_t>>(m, "CSRGraph")
+        .def_readonly("n_nodes", &CSRGraph<int64_t>::n_nodes)
+        .def_property_readonly("n_edges", &CSRGraph<int64_t>::n_edges);
+
+    py::class_<LevelStats>(m, "LevelStats")
+        .def_readonly("n_nodes", &LevelStats::n_nodes)
+        .def_readonly("n_edges", &LevelStats::n_edges)
+        .def_readonly("n_communities", &LevelStats::n_communities)
+        .def_readonly("modularity", &LevelStats::modularity)
+        .def_readonly("moves", &LevelStats::moves)
+        .def_readonly("sweep_modularity", &LevelStats::sweep_modularity)
+        .def_readonly("init_seconds", &LevelStats::init_seconds)
+        .def_readonly("move_seconds", &LevelStats::move_seconds)
+        .def_readonly("refine_seconds", &LevelStats::refine_seconds)
+        .def_readonly("aggregate_seconds", &LevelStats::aggregate_seconds)
+        .def_readonly("buffer_bytes", &LevelStats::buffer_bytes)
+        .def_property_readonly("sweeps", [](LevelStats const &stats)
+                               { return stats.moves.size(); });
+
+    m.def("get_adj", &get_adj<int64_t>);
+    m.def("init_status", [](CSRGraph<int64_t> const &graph)
+          { return init_status(graph); });
+    m.def("neighcom", [](CSRGraph<int64_t> const &graph,
+                         Nodes const &node2com,
+                         Node node)
+          {
+              DenseWeightMap neighbor_weight;
+              neighbor_weight.resize(graph.n_nodes);
+              neighcom(graph, node2com, node, neighbor_weight);
+
+              WeightMap result;
+              for (Node com : neighbor_weight.touched)
+                  result[com] = neighbor_weight.weight[com];
+              return result;
+          });
     m.def("modularity", &modularity);
-    m.def("one_level", &one_level);
-    m.def("renumber", &renumber);
-    m.def("induced_graph", &induced_graph);
+    m.def("one_level", [](CSRGraph<int64_t> const &graph,
+                          Nodes &node2com,
+                          Weights &internals,
+                          Weights const &loops,
+                          Weights &degrees,
+                          Weights const &gdegrees,
+                          float total_weight,
+                          float resolution)
+          {
+              one_level(graph,
+                        node2com, internals, loops, degrees, gdegrees,
+                        total_weight, resolution);
+          });
+    m.def("renumber", [](Nodes const &node2com)
+          {
+              Communities communities;
+              Nodes new_node2com;
+              renumber(node2com, communities, new_node2com);
+
+              GraphNeighbors result;
+              for (size_t com = 0; com < communities.size(); com++)
+                  result.emplace_back(communities[com].begin(),
+                                      communities[com].end());
+              return std::make_tuple(result, new_node2com);
+          });
+    m.def("induced_graph", [](CSRGraph<int64_t> const &graph,
+                              GraphNeighbors const &_communities,
+                              Nodes const &node2com)
+          {
+              Communities communities;
+              communities.start.push_back(0);
+              for (Nodes const &nodes : _communities)
+              {
+                  communities.nodes.insert(
+                      communities.nodes.end(), nodes.begin(), nodes.end());
+                  communities.start.push_back(communities.nodes.size());
+              }
+              ThreadPool pool(1);
+              return induced_graph(graph, communities, node2com, pool);
+          });
     m.def("get_partition", &get_partition);
-    m.def("generate_dendrogram", &generate_dendrogram);
-    m.def("generate_full_dendrogram", &generate_full_dendrogram);
+    m.def("generate_dendrogram", &generate_dendrogram,
+          py::arg("indptr"), py::arg("indices"), py::arg("data"),
+          py::arg("resolution") = 1, py::arg("prune") = false,
+          py::arg("n_threads") = 1, py::arg("method") = "louvain",
+          py::arg("membership") = py::none(),
+          py::arg("progress") = py::none(), py::arg("return_stats") = false,
+          py::arg("order") = "none", py::arg("seed") = 0,
+          py::arg("checkpoint") = "");
+    m.def("generate_consensus", &generate_consensus,
+          py::arg("indptr"), py::arg("indices"), py::arg("data"),
+          py::arg("n_runs") = 10, py::arg("seed") = 0,
+          py::arg("resolution") = 1, py::arg("prune") = false,
+          py::arg("n_threads") = 0, py::arg("method") = "louvain",
+          py::arg("progress") = py::none(), py::arg("return_stats") = false);
+    m.def("generate_full_dendrogram", &generate_full_dendrogram,
+          py::arg("indptr"), py::arg("indices"), py::arg("data"),
+          py::arg("resolution") = 1, py::arg("prune") = false,
+          py::arg("n_threads") = 1,
+          py::arg("progress") = py::none(), py::arg("return_stats") = false);
+    m.def("generate_dendrogram_file", &generate_dendrogram_file,
+          py::arg("path"), py::arg("resolution") = 1,
+          py::arg("prune") = false, py::arg("n_threads") = 1,
+          py::arg("method") = "louvain",
+          py::arg("progress") = py::none(), py::arg("return_stats") = false,
+          py::arg("order") = "none", py::arg("seed") = 0,
+          py::arg("checkpoint") = "");
+    m.def("generate_dendrogram_distributed", &generate_dendrogram_distributed,
+          py::arg("path"), py::arg("rank"), py::arg("n_ranks"),
+          py::arg("address"), py::arg("resolution") = 1,
+          py::arg("prune") = false, py::arg("n_threads") = 1,
+          py::arg("progress") = py::none(), py::arg("return_stats") = false);
+    m.def("convert_edgelist", &convert_edgelist_file,
+          py::arg("input"), py::arg("output"), py::arg("n_threads") = 0);
+    m.def("edges_to_csr", &edges_to_csr_arrays,
+          py::arg("sources"), py::arg("targets"),
+          py::arg("weights") = py::none(), py::arg("n_nodes") = py::none(),
+          py::arg("n_threads") = 0);
+    m.def("generate_partitions", &generate_partitions,
+          py::arg("graphs"), py::arg("resolution") = 1,
+          py::arg("prune") = false, py::arg("n_threads") = 0,
+          py::arg("method") = "louvain");
+    m.def("generate_multi_resolution", &generate_multi_resolution,
+          py::arg("indptr"), py::arg("indices"), py::arg("data"),
+          py::arg("resolutions"), py::arg("prune") = false,
+          py::arg("n_threads") = 0, py::arg("method") = "louvain");
+    m.def("partition_at_level", &partition_at_level,
+          py::arg("dendrogram"), py::arg("level") = 1);
+    m.def("score_dendrogram", &score_dendrogram,
+          py::arg("dendrogram"), py::arg("X"),
+          py::arg("scoring") = "silhouette", py::arg("sample_size") = 0,
+          py::arg("seed") = 0, py::arg("n_threads") = 0);
+    m.def("update_dendrogram", &update_dendrogram,
+          py::arg("indptr"), py::arg("indices"), py::arg("data"),
+          py::arg("dendrogram"), py::arg("changed"),
+          py::arg("resolution") = 1, py::arg("n_threads") = 1,
+          py::arg("progress") = py::none(), py::arg("return_stats") = false);
 }
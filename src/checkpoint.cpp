@@ -0,0 +1,183 @@
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <unistd.h>
+#include "checkpoint.hpp"
+
+const char CHECKPOINT_MAGIC[8] = {'L', 'V', 'N', 'C', 'K', 'P', 'T', '\0'};
+const uint32_t CHECKPOINT_VERSION = 1;
+
+Checkpoint::Checkpoint(
+    std::string path,
+    size_t n_nodes,
+    size_t n_edges,
+    float resolution,
+    bool prune,
+    bool leiden)
+    : path(std::move(path)), header()
+{
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header.version = CHECKPOINT_VERSION;
+    header.n_nodes = n_nodes;
+    header.n_edges = n_edges;
+    header.resolution = resolution;
+    header.flags = (prune ? CHECKPOINT_PRUNE : 0) |
+                   (leiden ? CHECKPOINT_LEIDEN : 0);
+}
+
+Checkpoint::~Checkpoint()
+{
+    if (writer.joinable())
+        writer.join();
+}
+
+void Checkpoint::wait()
+{
+    if (writer.joinable())
+        writer.join();
+    if (error)
+        std::rethrow_exception(std::exchange(error, nullptr));
+}
+
+void Checkpoint::finish(bool completed)
+{
+    wait();
+    if (completed)
+        std::remove(path.c_str());
+}
+
+template <typename Index>
+bool Checkpoint::load(
+    CSRGraph<Index> &graph,
+    double &mod,
+    GraphNeighbors &partition_list,
+    Nodes &membership)
+{
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    std::unique_ptr<FILE, int (*)(FILE *)> closer(file, std::fclose);
+    auto read = [&](void *data, size_t size)
+    {
+        if (std::fread(data, 1, size, file) != size)
+            throw std::runtime_error(path + " is truncated");
+    };
+
+    CheckpointHeader saved;
+    read(&saved, sizeof(saved));
+    if (std::memcmp(saved.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0)
+        throw std::runtime_error(path + " is not a checkpoint file");
+    if (saved.version != CHECKPOINT_VERSION)
+        throw std::runtime_error(path + " has an unsupported checkpoint version");
+    if (saved.index_size != sizeof(Index))
+        throw std::runtime_error(path + " was written with another index type");
+    if (saved.n_nodes != header.n_nodes || saved.n_edges != header.n_edges ||
+        saved.resolution != header.resolution || saved.flags != header.flags)
+        throw std::runtime_error(path + " is a checkpoint of another run");
+
+    std::vector<uint64_t> level_sizes(saved.n_levels);
+    read(level_sizes.data(), saved.n_levels * sizeof(uint64_t));
+    partition_list.resize(saved.n_levels);
+    for (size_t level = 0; level < saved.n_levels; level++)
+    {
+        partition_list[level].resize(level_sizes[level]);
+        read(partition_list[level].data(), level_sizes[level] * sizeof(Node));
+    }
+    membership.clear();
+    if (saved.flags & CHECKPOINT_LEIDEN)
+    {
+        membership.resize(saved.n_coarse_nodes);
+        read(membership.data(), saved.n_coarse_nodes * sizeof(Node));
+    }
+
+    std::vector<Index> indptr(saved.n_coarse_nodes + 1);
+    std::vector<Index> indices(saved.n_coarse_edges);
+    Weights weights(saved.n_coarse_edges);
+    read(indptr.data(), indptr.size() * sizeof(Index));
+    read(indices.data(), indices.size() * sizeof(Index));
+    read(weights.data(), weights.size() * sizeof(Weight));
+    if (size_t(indptr.back()) != saved.n_coarse_edges)
+        throw std::runtime_error(path + " has an inconsistent edge count");
+
+    graph = make_csr(std::move(indptr), std::move(indices), std::move(weights));
+    mod = saved.modularity;
+    return true;
+}
+
+template <typename Index>
+void Checkpoint::save(
+    CSRGraph<Index> const &graph,
+    double mod,
+    GraphNeighbors const &partition_list,
+    Nodes const &membership)
+{
+    wait();
+
+    CheckpointHeader saved = header;
+    saved.index_size = sizeof(Index);
+    saved.modularity = mod;
+    saved.n_levels = partition_list.size();
+    saved.n_coarse_nodes = graph.n_nodes;
+    saved.n_coarse_edges = graph.n_edges();
+
+    // the levels keep growing and induced_graph reuses the buffer of the
+    // graph, so the writer gets a copy of both
+    size_t indptr_bytes = (graph.n_nodes + 1) * sizeof(Index);
+    size_t indices_bytes = saved.n_coarse_edges * sizeof(Index);
+    size_t weights_bytes = saved.n_coarse_edges * sizeof(Weight);
+    snapshot.resize(indptr_bytes + indices_bytes + weights_bytes);
+    std::memcpy(snapshot.data(), graph.indptr, indptr_bytes);
+    std::memcpy(snapshot.data() + indptr_bytes, graph.indices, indices_bytes);
+    std::memcpy(snapshot.data() + indptr_bytes + indices_bytes,
+                graph.weights, weights_bytes);
+
+    writer = std::thread(
+        [this, saved, levels = partition_list, membership]()
+        {
+            try
+            {
+                std::string temporary = path + ".tmp";
+                FILE *file = std::fopen(temporary.c_str(), "wb");
+                if (!file)
+                    throw std::runtime_error("cannot create " + temporary);
+
+                bool ok = true;
+                auto write = [&](void const *data, size_t size)
+                {
+                    ok = ok && std::fwrite(data, 1, size, file) == size;
+                };
+                write(&saved, sizeof(saved));
+                for (Nodes const &level : levels)
+                {
+                    uint64_t size = level.size();
+                    write(&size, sizeof(size));
+                }
+                for (Nodes const &level : levels)
+                    write(level.data(), level.size() * sizeof(Node));
+                if (saved.flags & CHECKPOINT_LEIDEN)
+                    write(membership.data(), membership.size() * sizeof(Node));
+                write(snapshot.data(), snapshot.size());
+                // on disk before the rename, which could otherwise land
+                // first and leave a truncated checkpoint after a crash
+                ok = ok && std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+                ok = std::fclose(file) == 0 && ok;
+                if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0)
+                    throw std::runtime_error("cannot write " + path);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+        });
+}
+
+#define INSTANTIATE_CHECKPOINT(Index)                                       \
+    template bool Checkpoint::load(                                         \
+        CSRGraph<Index> &, double &, GraphNeighbors &, Nodes &);            \
+    template void Checkpoint::save(                                         \
+        CSRGraph<Index> const &, double, GraphNeighbors const &,            \
+        Nodes const &);
+
+INSTANTIATE_CHECKPOINT(int32_t)
+INSTANTIATE_CHECKPOINT(int64_t)
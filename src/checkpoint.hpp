@@ -0,0 +1,91 @@
+#pragma once
+#include <exception>
+#include <string>
+#include <thread>
+#include "algorithm.hpp"
+
+// Checkpoint file of a dendrogram run, rewritten at every level boundary:
+//
+//   CheckpointHeader
+//   level sizes        n_levels x uint64_t
+//   levels             the partition_list so far, as Node arrays
+//   membership         n_coarse_nodes x Node, leiden only
+//   indptr             (n_coarse_nodes + 1) x Index
+//   indices            n_coarse_edges x Index
+//   weights            n_coarse_edges x float
+//
+// The coarse graph is the one the next level runs on. The status vectors
+// are not stored: init_status rebuilds them from it at the start of that
+// level. Numbers are in native byte order.
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t index_size;
+    // the input graph and settings the run was started with
+    uint64_t n_nodes;
+    uint64_t n_edges;
+    float resolution;
+    uint32_t flags;
+    double modularity;
+    uint64_t n_levels;
+    uint64_t n_coarse_nodes;
+    uint64_t n_coarse_edges;
+};
+
+const uint32_t CHECKPOINT_PRUNE = 1;
+const uint32_t CHECKPOINT_LEIDEN = 2;
+
+// Checkpoints of one run at `path`. A write goes to a temporary file
+// synced and renamed over `path` once complete, so a run killed at any
+// point, or a crash of the machine, leaves the previous checkpoint
+// intact. Writes run on a thread of their own while the next level is
+// computed; only one is pending at a time.
+class Checkpoint
+{
+public:
+    Checkpoint(std::string path,
+               size_t n_nodes,
+               size_t n_edges,
+               float resolution,
+               bool prune,
+               bool leiden);
+
+    // waits for the pending write, whose error is lost
+    ~Checkpoint();
+
+    Checkpoint(Checkpoint const &) = delete;
+    Checkpoint &operator=(Checkpoint const &) = delete;
+
+    // Reads the checkpoint at `path` into the state of the run, and
+    // returns false if there is none. Throws if it belongs to a run on
+    // another graph or with other settings.
+    template <typename Index>
+    bool load(CSRGraph<Index> &graph,
+              double &mod,
+              GraphNeighbors &partition_list,
+              Nodes &membership);
+
+    // Starts writing the state after a level once the previous write is
+    // done. The writer works from copies, so the caller may reuse or
+    // free the graph as soon as this returns.
+    template <typename Index>
+    void save(CSRGraph<Index> const &graph,
+              double mod,
+              GraphNeighbors const &partition_list,
+              Nodes const &membership);
+
+    // Waits for the pending write and rethrows its error. A completed run
+    // has no use for its checkpoint, which is then deleted.
+    void finish(bool completed);
+
+private:
+    void wait();
+
+    std::string path;
+    CheckpointHeader header;
+    std::thread writer;
+    std::exception_ptr error;
+    // the arrays of the coarse graph being written, reused across saves
+    std::vector<char> snapshot;
+};
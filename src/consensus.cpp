@@ -0,0 +1,55 @@
+#include <utility>
+#include "consensus.hpp"
+
+template <typename Index, typename EdgeWeight>
+void count_co_occurrences(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes const &partition,
+    Weights &co_occurrences)
+{
+    for (Node node = 0; node < graph.n_nodes; node++)
+    {
+        Node node_com = partition[node];
+        for (Index i = graph.indptr[node]; i < graph.indptr[node + 1]; i++)
+        {
+            Node neighbor = graph.indices[i];
+            if (neighbor != node && partition[neighbor] == node_com)
+                co_occurrences[i] += 1;
+        }
+    }
+}
+
+template <typename Index, typename EdgeWeight>
+CSRGraph<Index> co_association_graph(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Weights &&co_occurrences,
+    size_t n_runs)
+{
+    for (Weight &weight : co_occurrences)
+        weight /= n_runs;
+
+    // the weights, along with whatever keeps the rows of `graph` alive
+    auto storage = std::make_shared<std::pair<std::shared_ptr<void>, Weights>>(
+        graph.storage, std::move(co_occurrences));
+    CSRGraph<Index> result;
+    result.n_nodes = graph.n_nodes;
+    result.indptr = graph.indptr;
+    result.indices = graph.indices;
+    result.weights = storage->second.data();
+    result.storage = storage;
+    return result;
+}
+
+#define INSTANTIATE_CONSENSUS(Index, EdgeWeight)                            \
+    template void count_co_occurrences(                                     \
+        CSRGraph<Index, EdgeWeight> const &, Nodes const &, Weights &);     \
+    template CSRGraph<Index> co_association_graph(                          \
+        CSRGraph<Index, EdgeWeight> const &, Weights &&, size_t);
+
+#define INSTANTIATE_INDEX(Index)                                            \
+    INSTANTIATE_CONSENSUS(Index, float)                                     \
+    INSTANTIATE_CONSENSUS(Index, double)                                    \
+    INSTANTIATE_CONSENSUS(Index, Unweighted)
+
+INSTANTIATE_INDEX(int32_t)
+INSTANTIATE_INDEX(int64_t)
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include "reorder.hpp"
+
+// Adds 1 to co_occurrences[i] for every edge i of the graph whose ends
+// are in the same community of `partition`. Self-loops are skipped: a
+// node always agrees with itself.
+template <typename Index, typename EdgeWeight>
+void count_co_occurrences(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes const &partition,
+    Weights &co_occurrences);
+
+// Co-association graph of n_runs partitions: the rows and neighbors of
+// `graph`, borrowed from it, with every edge weighing the fraction of the
+// runs that put its ends together. Only the pairs of linked nodes are
+// counted, so it takes one float per edge and no dense matrix.
+template <typename Index, typename EdgeWeight>
+CSRGraph<Index> co_association_graph(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Weights &&co_occurrences,
+    size_t n_runs);
+
+// Consensus clustering: run(graph, membership, n_threads, progress), a
+// dendrogram function, is called on n_runs copies of the graph in random
+// orders, seeded from seed to seed + n_runs - 1, spread over n_threads
+// threads. Their final partitions are only kept as co-occurrence counts,
+// and the result is the dendrogram of a last run on the co-association
+// graph, with all the threads. Only that run reports to `progress`.
+template <typename Index, typename EdgeWeight, typename F>
+GraphNeighbors consensus_dendrogram(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    size_t n_runs,
+    uint64_t seed,
+    int n_threads,
+    Progress *progress,
+    F const &run)
+{
+    Weights co_occurrences(graph.n_edges(), 0);
+    std::mutex mutex;
+    std::exception_ptr error;
+    {
+        ThreadPool pool(resolve_n_threads(n_threads));
+        pool.parallel_for(0, n_runs, [&](size_t k)
+        {
+            try
+            {
+                Nodes partition = flatten_dendrogram(run_in_order(
+                    graph, "random", seed + k, Nodes(), 1,
+                    [&](auto const &ordered, Nodes const &membership)
+                    { return run(ordered, membership, 1, nullptr); }));
+                std::lock_guard<std::mutex> lock(mutex);
+                count_co_occurrences(graph, partition, co_occurrences);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                error = std::current_exception();
+            }
+        }, 1);
+    }
+    if (error)
+        std::rethrow_exception(error);
+
+    return run(co_association_graph(graph, std::move(co_occurrences), n_runs),
+               Nodes(), n_threads, progress);
+}
@@ -0,0 +1,512 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include "distributed.hpp"
+#include "graph_io.hpp"
+
+// how long the ranks wait for each other to connect
+const int CONNECT_TIMEOUT_MS = 60000;
+
+// exchanges of moves per sweep of distributed local moving
+const size_t EXCHANGE_ROUNDS = 16;
+
+bool send_all(int fd, void const *data, size_t size)
+{
+    char const *p = (char const *)data;
+    while (size > 0)
+    {
+        // MSG_NOSIGNAL: a closed peer is an error, not a SIGPIPE
+        ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool receive_all(int fd, void *data, size_t size)
+{
+    char *p = (char *)data;
+    while (size > 0)
+    {
+        ssize_t n = ::recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+const std::string TCP_PREFIX = "tcp://";
+
+// Where rank 0 listens: "tcp://host:port", or the path of a Unix domain
+// socket
+struct SocketAddress
+{
+    sockaddr_storage name;
+    socklen_t length;
+    bool tcp;
+};
+
+SocketAddress resolve_address(std::string const &address)
+{
+    SocketAddress resolved = {};
+    if (address.compare(0, TCP_PREFIX.size(), TCP_PREFIX) != 0)
+    {
+        sockaddr_un name = {};
+        name.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(name.sun_path))
+            throw std::invalid_argument("socket address is too long: " + address);
+        std::copy(address.begin(), address.end(), name.sun_path);
+        std::memcpy(&resolved.name, &name, sizeof(name));
+        resolved.length = sizeof(name);
+        return resolved;
+    }
+
+    std::string host_port = address.substr(TCP_PREFIX.size());
+    size_t colon = host_port.rfind(':');
+    if (colon == std::string::npos || colon + 1 == host_port.size())
+        throw std::invalid_argument("expected tcp://host:port, got " + address);
+    std::string host = host_port.substr(0, colon);
+    std::string port = host_port.substr(colon + 1);
+    // [::1]:port
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *found = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(),
+                    &hints, &found) != 0 || !found)
+        throw std::invalid_argument("cannot resolve " + address);
+    std::memcpy(&resolved.name, found->ai_addr, found->ai_addrlen);
+    resolved.length = found->ai_addrlen;
+    resolved.tcp = true;
+    freeaddrinfo(found);
+    return resolved;
+}
+
+// The ranks exchange many small messages: TCP must not hold them back
+void set_no_delay(SocketAddress const &resolved, int fd)
+{
+    int on = 1;
+    if (resolved.tcp)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+Communicator::Communicator(std::string const &address, int rank, int n_ranks)
+    : own_rank(rank), n_ranks(n_ranks)
+{
+    if (n_ranks < 1 || rank < 0 || rank >= n_ranks)
+        throw std::invalid_argument("rank must be in [0, n_ranks)");
+    if (n_ranks == 1)
+        return;
+
+    SocketAddress resolved = resolve_address(address);
+    sockaddr *name = (sockaddr *)&resolved.name;
+    int family = resolved.name.ss_family;
+    // only a Unix socket leaves a file behind
+    auto unlink_socket = [&]()
+    {
+        if (!resolved.tcp)
+            unlink(address.c_str());
+    };
+
+    if (rank == 0)
+    {
+        int listener = socket(family, SOCK_STREAM, 0);
+        if (listener < 0)
+            throw std::runtime_error("cannot create a socket");
+        unlink_socket();
+        int on = 1;
+        if (resolved.tcp)
+            setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(listener, name, resolved.length) != 0 ||
+            listen(listener, n_ranks) != 0)
+        {
+            close(listener);
+            throw std::runtime_error("cannot listen on " + address);
+        }
+
+        // every other rank connects and sends its rank
+        peers.assign(n_ranks, -1);
+        for (int i = 1; i < n_ranks; i++)
+        {
+            pollfd waiting = {listener, POLLIN, 0};
+            int peer = poll(&waiting, 1, CONNECT_TIMEOUT_MS) == 1
+                           ? accept(listener, nullptr, nullptr)
+                           : -1;
+            int32_t peer_rank = -1;
+            if (peer >= 0 && !receive_all(peer, &peer_rank, sizeof(peer_rank)))
+                peer_rank = -1;
+            if (peer_rank <= 0 || peer_rank >= n_ranks || peers[peer_rank] >= 0)
+            {
+                if (peer >= 0)
+                    close(peer);
+                close(listener);
+                unlink_socket();
+                for (int fd : peers)
+                {
+                    if (fd >= 0)
+                        close(fd);
+                }
+                throw std::runtime_error("not every rank connected to " + address);
+            }
+            set_no_delay(resolved, peer);
+            peers[peer_rank] = peer;
+        }
+        close(listener);
+        unlink_socket();
+    }
+    else
+    {
+        // rank 0 may not be listening yet
+        auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(CONNECT_TIMEOUT_MS);
+        while (true)
+        {
+            int fd = socket(family, SOCK_STREAM, 0);
+            if (fd < 0)
+                throw std::runtime_error("cannot create a socket");
+            if (connect(fd, name, resolved.length) == 0)
+            {
+                set_no_delay(resolved, fd);
+                peers.push_back(fd);
+                break;
+            }
+            close(fd);
+            if (std::chrono::steady_clock::now() > deadline)
+                throw std::runtime_error("cannot connect to " + address);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        int32_t sent_rank = rank;
+        if (!send_all(peers[0], &sent_rank, sizeof(sent_rank)))
+        {
+            close(peers[0]);
+            throw std::runtime_error("cannot connect to " + address);
+        }
+    }
+}
+
+Communicator::~Communicator()
+{
+    for (int fd : peers)
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+void Communicator::send(int peer, std::vector<char> const &bytes)
+{
+    uint64_t size = bytes.size();
+    if (!send_all(peers[peer], &size, sizeof(size)) ||
+        !send_all(peers[peer], bytes.data(), size))
+        throw std::runtime_error("lost the connection to rank " + std::to_string(peer));
+}
+
+std::vector<char> Communicator::receive(int peer)
+{
+    uint64_t size;
+    std::vector<char> bytes;
+    bool ok = receive_all(peers[peer], &size, sizeof(size));
+    if (ok)
+    {
+        bytes.resize(size);
+        ok = receive_all(peers[peer], bytes.data(), size);
+    }
+    if (!ok)
+        throw std::runtime_error("lost the connection to rank " + std::to_string(peer));
+    return bytes;
+}
+
+std::vector<std::vector<char>> Communicator::gather_bytes(std::vector<char> const &local)
+{
+    std::vector<std::vector<char>> result;
+    if (own_rank != 0)
+    {
+        send(0, local);
+        return result;
+    }
+    result.push_back(local);
+    for (int peer = 1; peer < n_ranks; peer++)
+        result.push_back(receive(peer));
+    return result;
+}
+
+void Communicator::broadcast_bytes(std::vector<char> &bytes)
+{
+    if (own_rank != 0)
+    {
+        bytes = receive(0);
+        return;
+    }
+    for (int peer = 1; peer < n_ranks; peer++)
+        send(peer, bytes);
+}
+
+std::vector<double> Communicator::all_sum(std::vector<double> const &values)
+{
+    std::vector<double> sums(values.size(), 0);
+    for (std::vector<double> const &part : gather(values))
+    {
+        for (size_t i = 0; i < sums.size(); i++)
+            sums[i] += part[i];
+    }
+    std::vector<char> bytes = to_bytes(sums);
+    broadcast_bytes(bytes);
+    return from_bytes<double>(bytes);
+}
+
+template <typename Index, typename EdgeWeight>
+Nodes shard_bounds(CSRGraph<Index, EdgeWeight> const &graph, int n_ranks)
+{
+    size_t n_edges = graph.n_edges();
+    Nodes bounds(n_ranks + 1, graph.n_nodes);
+    bounds[0] = 0;
+    for (int rank = 1; rank < n_ranks; rank++)
+    {
+        Index share = n_edges * rank / n_ranks;
+        bounds[rank] = std::lower_bound(
+            graph.indptr, graph.indptr + graph.n_nodes, share) - graph.indptr;
+    }
+    return bounds;
+}
+
+// A node that changed community during a sweep, as sent to the other ranks
+struct Move
+{
+    Node node;
+    Node com;
+    Weight gdegree;
+};
+
+template <typename Index, typename EdgeWeight>
+GraphNeighbors distributed_dendrogram(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    float resolution,
+    bool prune,
+    int n_threads,
+    Communicator &comm,
+    Progress *progress)
+{
+    Progress ignored;
+    if (!progress || comm.rank() != 0)
+        progress = &ignored;
+    size_t n_nodes = graph.n_nodes;
+
+    std::vector<uint64_t> shape = {n_nodes, graph.n_edges()};
+    std::vector<uint64_t> shapes = comm.all_gather(shape);
+    for (size_t i = 0; i < shapes.size(); i++)
+    {
+        if (shapes[i] != shape[i % 2])
+            throw std::invalid_argument("the ranks were given different graphs");
+    }
+    Nodes bounds = shard_bounds(graph, comm.size());
+    Node first = bounds[comm.rank()];
+    Node last = bounds[comm.rank() + 1];
+
+    // init_status: gdegrees and loops of the owned nodes, indexed from
+    // `first`, and the degree of every community on every rank
+    progress->start_level(n_nodes, graph.n_edges());
+    Weights gdegrees(last - first);
+    Weights loops(last - first);
+    double own_weight = 0;
+    for (Node node = first; node < last; node++)
+    {
+        double degree = 0;
+        for (Index i = graph.indptr[node]; i < graph.indptr[node + 1]; i++)
+        {
+            double weight = graph.weight(i);
+            if (graph.indices[i] == node)
+            {
+                loops[node - first] += weight;
+                weight *= 2;
+            }
+            degree += weight;
+        }
+        gdegrees[node - first] = degree;
+        own_weight += degree;
+    }
+    float total_weight = comm.all_sum({own_weight})[0] / 2;
+    float m = 2 * total_weight;
+    Weights degrees = comm.all_gather(gdegrees);
+    Nodes node2com(n_nodes);
+    std::iota(node2com.begin(), node2com.end(), 0);
+    Nodes com_size(n_nodes, 1);
+    progress->add_time(&LevelStats::init_seconds);
+
+    // this rank's share of the modularity: the weight inside communities
+    // seen from its rows, and the degree terms of the communities whose
+    // ids fall in its range
+    auto own_modularity = [&]()
+    {
+        double inside = 0;
+        double squares = 0;
+        for (Node node = first; node < last; node++)
+        {
+            Node node_com = node2com[node];
+            double node_inside = 0;
+            for (Index i = graph.indptr[node]; i < graph.indptr[node + 1]; i++)
+            {
+                Node neighbor = graph.indices[i];
+                if (neighbor != node && node2com[neighbor] == node_com)
+                    node_inside += graph.weight(i);
+            }
+            inside += node_inside / 2 + loops[node - first];
+            double degree = degrees[node] / double(m);
+            squares += degree * degree;
+        }
+        return resolution * inside / total_weight - squares;
+    };
+
+    // one_level over the owned nodes. A sweep is cut in rounds, after
+    // each of which the ranks apply each other's moves: the fewer nodes
+    // moved on stale information, the fewer moves undo each other.
+    DenseWeightMap neighbor_weight;
+    neighbor_weight.resize(n_nodes);
+    std::vector<Move> moves;
+    double mod = comm.all_sum({own_modularity()})[0];
+    bool stopped = false;
+    while (true)
+    {
+        size_t n_moved = 0;
+        for (size_t round = 0; round < EXCHANGE_ROUNDS; round++)
+        {
+            Node begin = first + (last - first) * round / EXCHANGE_ROUNDS;
+            Node end = first + (last - first) * (round + 1) / EXCHANGE_ROUNDS;
+            moves.clear();
+            for (Node node = begin; node < end; node++)
+            {
+                Node node_com = node2com[node];
+                Weight node_gdegree = gdegrees[node - first];
+                neighcom(graph, node2com, node, neighbor_weight);
+
+                degrees[node_com] -= node_gdegree;
+                float best_increase = 0;
+                Node best_com = best_community(
+                    neighbor_weight, degrees, node_com, degrees[node_com],
+                    node_gdegree, resolution, m, best_increase);
+                // two singletons on different ranks could each join the other
+                // and swap: only the one with the larger id moves
+                if (com_size[node_com] == 1 && com_size[best_com] == 1 &&
+                    best_com > node_com)
+                    best_com = node_com;
+                degrees[best_com] += node_gdegree;
+
+                if (best_com != node_com)
+                {
+                    node2com[node] = best_com;
+                    com_size[node_com]--;
+                    com_size[best_com]++;
+                    moves.push_back({node, best_com, node_gdegree});
+                }
+            }
+
+            std::vector<Move> all_moves = comm.all_gather(moves);
+            for (Move const &move : all_moves)
+            {
+                if (move.node >= first && move.node < last)
+                    continue;
+                Node old_com = node2com[move.node];
+                degrees[old_com] -= move.gdegree;
+                degrees[move.com] += move.gdegree;
+                com_size[old_com]--;
+                com_size[move.com]++;
+                node2com[move.node] = move.com;
+            }
+            n_moved += all_moves.size();
+        }
+
+        double new_mod = comm.all_sum({own_modularity()})[0];
+        double gain = new_mod - mod;
+        mod = new_mod;
+        progress->sweep(n_moved, mod);
+        // rank 0 decides for everyone whether to stop
+        stopped = comm.all_sum({progress->stopped() ? 1. : 0.})[0] > 0;
+        if (stopped || n_moved == 0 || gain < 0.0000001)
+            break;
+    }
+    progress->add_time(&LevelStats::move_seconds);
+
+    // renumber gives the same result on every rank, and each one
+    // aggregates the rows it owns
+    ThreadPool pool(resolve_n_threads(n_threads));
+    Communities communities;
+    renumber(node2com, communities, node2com);
+    Communities owned;
+    owned.start.push_back(0);
+    for (size_t com = 0; com < communities.size(); com++)
+    {
+        for (Node node : communities[com])
+        {
+            if (node >= first && node < last)
+                owned.nodes.push_back(node);
+        }
+        owned.start.push_back(owned.nodes.size());
+    }
+    CSRGraph<Index> partial = induced_graph(graph, owned, node2com, pool);
+
+    // the coarse graph is the sum of the partial ones: gather one
+    // direction of their edges and let edges_to_csr merge them
+    WeightedEdges edges;
+    for (Node com = 0; com < partial.n_nodes; com++)
+    {
+        for (Index i = partial.indptr[com]; i < partial.indptr[com + 1]; i++)
+        {
+            if (partial.indices[i] >= com)
+                edges.push_back({com, partial.indices[i], partial.weights[i]});
+        }
+    }
+    std::vector<WeightedEdges> parts = comm.gather(edges);
+    if (comm.rank() != 0)
+        return GraphNeighbors();
+
+    size_t bytes = capacity_bytes(node2com) + capacity_bytes(degrees) +
+                   capacity_bytes(com_size) + capacity_bytes(gdegrees) +
+                   capacity_bytes(loops) + neighbor_weight.bytes() +
+                   communities.bytes() + owned.bytes();
+    CSRGraph<Index> coarse = edges_to_csr<Index>(communities.size(), parts, pool);
+    progress->add_time(&LevelStats::aggregate_seconds);
+    progress->end_level(communities.size(), mod, bytes);
+
+    GraphNeighbors partition_list;
+    partition_list.push_back(std::move(node2com));
+    if (stopped)
+        return partition_list;
+    for (Nodes &level : coarse_dendrogram(std::move(coarse), mod, resolution,
+                                          prune, n_threads, progress))
+        partition_list.push_back(std::move(level));
+    return partition_list;
+}
+
+#define INSTANTIATE_DISTRIBUTED(Index, EdgeWeight)                          \
+    template Nodes shard_bounds(CSRGraph<Index, EdgeWeight> const &, int);  \
+    template GraphNeighbors distributed_dendrogram(                         \
+        CSRGraph<Index, EdgeWeight> const &, float, bool, int,              \
+        Communicator &, Progress *);
+
+// the weight types of graph files
+#define INSTANTIATE_INDEX(Index)                                            \
+    INSTANTIATE_DISTRIBUTED(Index, float)                                   \
+    INSTANTIATE_DISTRIBUTED(Index, Unweighted)
+
+INSTANTIATE_INDEX(int32_t)
+INSTANTIATE_INDEX(int64_t)
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstring>
+#include <string>
+#include <vector>
+#include "algorithm.hpp"
+
+// One of the n_ranks processes of a distributed run. The processes are
+// connected in a star around rank 0, which listens at `address`: either
+// "tcp://host:port", for ranks on several hosts, or the path of a Unix
+// domain socket, for ranks on the same host. Rank 0 creates the socket and
+// the other ranks retry until it is there. Every collective call must be
+// made by all ranks in the same order. A rank that dies makes the others
+// throw rather than hang.
+class Communicator
+{
+public:
+    Communicator(std::string const &address, int rank, int n_ranks);
+    ~Communicator();
+
+    Communicator(Communicator const &) = delete;
+    Communicator &operator=(Communicator const &) = delete;
+
+    int rank() const { return own_rank; }
+    int size() const { return n_ranks; }
+
+    // `local` of every rank, in rank order, on rank 0 (empty elsewhere)
+    template <typename T>
+    std::vector<std::vector<T>> gather(std::vector<T> const &local)
+    {
+        std::vector<std::vector<T>> result;
+        for (std::vector<char> const &bytes : gather_bytes(to_bytes(local)))
+            result.push_back(from_bytes<T>(bytes));
+        return result;
+    }
+
+    // `local` of every rank concatenated in rank order, on every rank
+    template <typename T>
+    std::vector<T> all_gather(std::vector<T> const &local)
+    {
+        std::vector<char> bytes;
+        for (std::vector<char> const &part : gather_bytes(to_bytes(local)))
+            bytes.insert(bytes.end(), part.begin(), part.end());
+        broadcast_bytes(bytes);
+        return from_bytes<T>(bytes);
+    }
+
+    // element-wise sum of `values` over the ranks, on every rank. The sum
+    // is done by rank 0 in rank order, so every rank gets the same result.
+    std::vector<double> all_sum(std::vector<double> const &values);
+
+private:
+    template <typename T>
+    static std::vector<char> to_bytes(std::vector<T> const &values)
+    {
+        std::vector<char> bytes(values.size() * sizeof(T));
+        if (!bytes.empty())
+            std::memcpy(bytes.data(), values.data(), bytes.size());
+        return bytes;
+    }
+
+    template <typename T>
+    static std::vector<T> from_bytes(std::vector<char> const &bytes)
+    {
+        std::vector<T> values(bytes.size() / sizeof(T));
+        if (!values.empty())
+            std::memcpy(values.data(), bytes.data(), values.size() * sizeof(T));
+        return values;
+    }
+
+    std::vector<std::vector<char>> gather_bytes(std::vector<char> const &local);
+    void broadcast_bytes(std::vector<char> &bytes);
+    void send(int peer, std::vector<char> const &bytes);
+    std::vector<char> receive(int peer);
+
+    int own_rank;
+    int n_ranks;
+    // on rank 0, the socket of every other rank (peers[0] is unused);
+    // elsewhere, peers[0] is the socket to rank 0
+    std::vector<int> peers;
+};
+
+// Node range of every rank, balanced by edge count: rank r owns the rows
+// [bounds[r], bounds[r + 1]) of the graph
+template <typename Index, typename EdgeWeight>
+Nodes shard_bounds(CSRGraph<Index, EdgeWeight> const &graph, int n_ranks);
+
+// Louvain on a graph split by rows across the ranks of `comm`. Every rank
+// passes the same graph, in practice the same mapped file (load_csr) of
+// which it only reads its own rows, and runs local moving on the nodes it
+// owns. The edges are split, but node2com and the community degrees are
+// kept whole on every rank: the ranks exchange their moves several times
+// per sweep and apply each other's degree changes. Only the first level
+// runs this way: its coarse graph is gathered on rank 0, which computes
+// the other levels alone. Rank 0 returns the dendrogram, the other ranks
+// nothing. Progress is only reported on rank 0.
+//
+// Every rank thus holds O(n_nodes) memory whatever n_ranks is: node2com,
+// the community degrees and sizes, and a neighbor map. Only the O(n_edges)
+// part is divided, so a graph whose node arrays do not fit on one host
+// cannot be clustered this way, and rank 0 must also fit the coarse graph.
+template <typename Index, typename EdgeWeight>
+GraphNeighbors distributed_dendrogram(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    float resolution,
+    bool prune,
+    int n_threads,
+    Communicator &comm,
+    Progress *progress = nullptr);
@@ -0,0 +1,429 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include "graph_io.hpp"
+
+const char CSR_MAGIC[8] = {'L', 'V', 'N', 'C', 'S', 'R', '\0', '\0'};
+const uint32_t CSR_VERSION = 2;
+
+size_t align8(size_t offset)
+{
+    return (offset + 7) / 8 * 8;
+}
+
+// Read-only mapping of a whole file, unmapped on destruction
+struct MappedFile
+{
+    char const *data = nullptr;
+    size_t size = 0;
+
+    explicit MappedFile(std::string const &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("cannot open " + path);
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+        {
+            close(fd);
+            throw std::runtime_error("cannot stat " + path);
+        }
+        size = info.st_size;
+        if (size > 0)
+        {
+            void *ptr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (ptr == MAP_FAILED)
+            {
+                close(fd);
+                throw std::runtime_error("cannot map " + path);
+            }
+            data = (char const *)ptr;
+        }
+        close(fd);
+    }
+
+    ~MappedFile()
+    {
+        if (data)
+            munmap((void *)data, size);
+    }
+
+    MappedFile(MappedFile const &) = delete;
+    MappedFile &operator=(MappedFile const &) = delete;
+};
+
+CSRFileHeader read_csr_header(std::string const &path)
+{
+    CSRFileHeader header;
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        throw std::runtime_error("cannot open " + path);
+    size_t n_read = std::fread(&header, sizeof(header), 1, file);
+    std::fclose(file);
+
+    if (n_read != 1 || std::memcmp(header.magic, CSR_MAGIC, sizeof(CSR_MAGIC)) != 0)
+        throw std::runtime_error(path + " is not a CSR graph file");
+    if (header.version < 1 || header.version > CSR_VERSION)
+        throw std::runtime_error(path + " has an unsupported CSR version");
+    if (header.version == 1)
+        header.flags = 0;
+    if (header.index_size != 4 && header.index_size != 8)
+        throw std::runtime_error(path + " has an invalid index size");
+    return header;
+}
+
+template <typename Index, typename EdgeWeight>
+CSRGraph<Index, EdgeWeight> load_csr(std::string const &path)
+{
+    constexpr bool unweighted = std::is_same_v<EdgeWeight, Unweighted>;
+    CSRFileHeader header = read_csr_header(path);
+    if (header.index_size != sizeof(Index))
+        throw std::runtime_error(path + " was written with another index type");
+    if (bool(header.flags & CSR_UNWEIGHTED) != unweighted)
+        throw std::runtime_error(path + " was written with another weight type");
+
+    auto file = std::make_shared<MappedFile>(path);
+    size_t indptr_offset = sizeof(CSRFileHeader);
+    size_t indices_offset = align8(indptr_offset + (header.n_nodes + 1) * sizeof(Index));
+    size_t indices_end = indices_offset + header.n_edges * sizeof(Index);
+    size_t weights_offset = align8(indices_end);
+    // unweighted files end with the indices, without padding
+    size_t end = unweighted ? indices_end
+                            : weights_offset + header.n_edges * sizeof(Weight);
+    if (file->size < end)
+        throw std::runtime_error(path + " is truncated");
+
+    // node visits jump around the whole graph
+    madvise((void *)file->data, file->size, MADV_RANDOM);
+
+    CSRGraph<Index, EdgeWeight> graph;
+    graph.n_nodes = header.n_nodes;
+    graph.indptr = (Index const *)(file->data + indptr_offset);
+    graph.indices = (Index const *)(file->data + indices_offset);
+    if constexpr (!unweighted)
+        graph.weights = (Weight const *)(file->data + weights_offset);
+    graph.storage = file;
+    if (graph.n_edges() != header.n_edges)
+        throw std::runtime_error(path + " has an inconsistent edge count");
+    return graph;
+}
+
+template <typename Index, typename EdgeWeight>
+void save_csr(std::string const &path, CSRGraph<Index, EdgeWeight> const &graph)
+{
+    constexpr bool unweighted = std::is_same_v<EdgeWeight, Unweighted>;
+    CSRFileHeader header = {};
+    std::memcpy(header.magic, CSR_MAGIC, sizeof(CSR_MAGIC));
+    header.version = CSR_VERSION;
+    header.index_size = sizeof(Index);
+    header.n_nodes = graph.n_nodes;
+    header.n_edges = graph.n_edges();
+    header.flags = unweighted ? CSR_UNWEIGHTED : 0;
+
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        throw std::runtime_error("cannot create " + path);
+
+    char const padding[8] = {};
+    size_t offset = 0;
+    bool ok = true;
+    auto write = [&](void const *data, size_t size)
+    {
+        ok = ok && std::fwrite(data, 1, size, file) == size;
+        offset += size;
+    };
+    auto pad = [&]() { write(padding, align8(offset) - offset); };
+
+    write(&header, sizeof(header));
+    write(graph.indptr, (graph.n_nodes + 1) * sizeof(Index));
+    pad();
+    write(graph.indices, header.n_edges * sizeof(Index));
+    if constexpr (!unweighted)
+    {
+        pad();
+        write(graph.weights, header.n_edges * sizeof(Weight));
+    }
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok)
+        throw std::runtime_error("cannot write " + path);
+}
+
+// edges_to_csr over n_parts parts of edges, for_each_edge(part, fn)
+// calling fn(source, target, weight) on every edge of a part
+template <typename Index, typename EdgeWeight, typename F>
+CSRGraph<Index, EdgeWeight> parts_to_csr(
+    size_t n_nodes,
+    size_t n_parts,
+    F const &for_each_edge,
+    ThreadPool &pool)
+{
+    // row sizes with both directions of every edge
+    std::unique_ptr<std::atomic<Index>[]> cursor(new std::atomic<Index>[n_nodes + 1]);
+    for (size_t node = 0; node <= n_nodes; node++)
+        cursor[node].store(0, std::memory_order_relaxed);
+    pool.parallel_for(0, n_parts, [&](size_t part)
+    {
+        for_each_edge(part, [&](Node source, Node target, EdgeWeight)
+        {
+            cursor[source].fetch_add(1, std::memory_order_relaxed);
+            if (source != target)
+                cursor[target].fetch_add(1, std::memory_order_relaxed);
+        });
+    }, 1);
+
+    std::vector<Index> row_start(n_nodes + 1, 0);
+    for (size_t node = 0; node < n_nodes; node++)
+    {
+        row_start[node + 1] = row_start[node] + cursor[node].load(std::memory_order_relaxed);
+        cursor[node].store(row_start[node], std::memory_order_relaxed);
+    }
+
+    std::vector<Index> indices(row_start[n_nodes]);
+    std::vector<EdgeWeight> weights(row_start[n_nodes]);
+    pool.parallel_for(0, n_parts, [&](size_t part)
+    {
+        for_each_edge(part, [&](Node source, Node target, EdgeWeight weight)
+        {
+            Index k = cursor[source].fetch_add(1, std::memory_order_relaxed);
+            indices[k] = target;
+            weights[k] = weight;
+            if (source == target)
+                return;
+            k = cursor[target].fetch_add(1, std::memory_order_relaxed);
+            indices[k] = source;
+            weights[k] = weight;
+        });
+    }, 1);
+
+    // sort every row and merge its duplicates in place
+    std::vector<Index> row_size(n_nodes);
+    std::vector<std::vector<std::pair<Index, EdgeWeight>>> thread_row(pool.size());
+    pool.parallel_for_thread(0, n_nodes, [&](size_t thread, size_t node)
+    {
+        std::vector<std::pair<Index, EdgeWeight>> &row = thread_row[thread];
+        row.clear();
+        for (Index k = row_start[node]; k < row_start[node + 1]; k++)
+            row.emplace_back(indices[k], weights[k]);
+        // full pair order, so that duplicates are summed in the same order
+        // whatever the thread that wrote them
+        std::sort(row.begin(), row.end());
+
+        Index k = row_start[node];
+        for (size_t i = 0; i < row.size(); i++)
+        {
+            if (i > 0 && row[i].first == row[i - 1].first)
+            {
+                weights[k - 1] += row[i].second;
+                continue;
+            }
+            indices[k] = row[i].first;
+            weights[k] = row[i].second;
+            k++;
+        }
+        row_size[node] = k - row_start[node];
+    });
+
+    std::vector<Index> indptr(n_nodes + 1, 0);
+    for (size_t node = 0; node < n_nodes; node++)
+        indptr[node + 1] = indptr[node] + row_size[node];
+    std::vector<Index> new_indices(indptr[n_nodes]);
+    std::vector<EdgeWeight> new_weights(indptr[n_nodes]);
+    pool.parallel_for(0, n_nodes, [&](size_t node)
+    {
+        std::copy(indices.begin() + row_start[node],
+                  indices.begin() + row_start[node] + row_size[node],
+                  new_indices.begin() + indptr[node]);
+        std::copy(weights.begin() + row_start[node],
+                  weights.begin() + row_start[node] + row_size[node],
+                  new_weights.begin() + indptr[node]);
+    });
+
+    return make_csr(std::move(indptr),
+                    std::move(new_indices),
+                    std::move(new_weights));
+}
+
+template <typename Index>
+CSRGraph<Index> edges_to_csr(
+    size_t n_nodes,
+    std::vector<WeightedEdges> const &edges,
+    ThreadPool &pool)
+{
+    return parts_to_csr<Index, Weight>(
+        n_nodes, edges.size(), [&](size_t part, auto const &fn)
+        {
+            for (WeightedEdge const &edge : edges[part])
+                fn(edge.source, edge.target, edge.weight);
+        }, pool);
+}
+
+template <typename Index, typename EdgeWeight>
+CSRGraph<Index, EdgeWeight> edges_to_csr(
+    size_t n_nodes,
+    Node const *sources,
+    Node const *targets,
+    EdgeWeight const *weights,
+    size_t n_edges,
+    ThreadPool &pool)
+{
+    // a few parts per thread, as the rows they hit may not be balanced
+    size_t n_parts = std::min(n_edges, 4 * pool.size());
+    return parts_to_csr<Index, EdgeWeight>(
+        n_nodes, n_parts, [&](size_t part, auto const &fn)
+        {
+            size_t begin = n_edges * part / n_parts;
+            size_t end = n_edges * (part + 1) / n_parts;
+            for (size_t i = begin; i < end; i++)
+                fn(sources[i], targets[i], weights ? weights[i] : 1);
+        }, pool);
+}
+
+// Saves the graph as is, or without its weights when they are all 1
+template <typename Index>
+void save_edgelist_csr(std::string const &path, CSRGraph<Index> const &graph)
+{
+    if (!std::all_of(graph.weights, graph.weights + graph.n_edges(),
+                     [](Weight weight) { return weight == 1; }))
+    {
+        save_csr(path, graph);
+        return;
+    }
+    CSRGraph<Index, Unweighted> unweighted;
+    unweighted.n_nodes = graph.n_nodes;
+    unweighted.indptr = graph.indptr;
+    unweighted.indices = graph.indices;
+    unweighted.storage = graph.storage;
+    save_csr(path, unweighted);
+}
+
+bool is_separator(char c)
+{
+    return c == ' ' || c == '\t' || c == ',' || c == '\r';
+}
+
+// Parses the lines of text[begin, end) into `edges`. Returns false on a
+// malformed line.
+bool parse_edges(char const *text, size_t begin, size_t end, WeightedEdges &edges)
+{
+    char const *p = text + begin;
+    char const *stop = text + end;
+    while (p < stop)
+    {
+        char const *line_end = (char const *)std::memchr(p, '\n', stop - p);
+        if (!line_end)
+            line_end = stop;
+
+        while (p < line_end && is_separator(*p))
+            p++;
+        if (p == line_end || *p == '#' || *p == '%')
+        {
+            p = line_end + 1;
+            continue;
+        }
+
+        WeightedEdge edge{0, 0, 1};
+        auto [after_source, source_error] = std::from_chars(p, line_end, edge.source);
+        p = after_source;
+        while (p < line_end && is_separator(*p))
+            p++;
+        auto [after_target, target_error] = std::from_chars(p, line_end, edge.target);
+        p = after_target;
+        if (source_error != std::errc() || target_error != std::errc() ||
+            edge.source < 0 || edge.target < 0)
+            return false;
+
+        while (p < line_end && is_separator(*p))
+            p++;
+        if (p < line_end)
+        {
+            // strtof needs a terminated string
+            char number[64] = {};
+            std::memcpy(number, p, std::min<size_t>(line_end - p, sizeof(number) - 1));
+            char *after_weight;
+            edge.weight = std::strtof(number, &after_weight);
+            if (after_weight == number)
+                return false;
+        }
+
+        edges.push_back(edge);
+        p = line_end + 1;
+    }
+    return true;
+}
+
+CSRFileHeader convert_edgelist(
+    std::string const &input,
+    std::string const &output,
+    int n_threads)
+{
+    ThreadPool pool(resolve_n_threads(n_threads));
+    MappedFile text(input);
+    madvise((void *)text.data, text.size, MADV_SEQUENTIAL);
+
+    // one chunk per thread, cut right after a newline
+    size_t n_chunks = text.size ? pool.size() : 0;
+    std::vector<size_t> chunk_start(n_chunks + 1, text.size);
+    for (size_t chunk = 0; chunk < n_chunks; chunk++)
+    {
+        size_t start = chunk == 0 ? 0 : text.size / n_chunks * chunk;
+        while (start > 0 && start < text.size && text.data[start - 1] != '\n')
+            start++;
+        chunk_start[chunk] = std::max(start, chunk > 0 ? chunk_start[chunk - 1] : 0);
+    }
+
+    std::vector<WeightedEdges> edges(n_chunks);
+    std::vector<char> valid(n_chunks, 1);
+    std::vector<Node> max_node(n_chunks, -1);
+    pool.parallel_for(0, n_chunks, [&](size_t chunk)
+    {
+        valid[chunk] = parse_edges(text.data, chunk_start[chunk],
+                                   chunk_start[chunk + 1], edges[chunk]);
+        for (WeightedEdge const &edge : edges[chunk])
+            max_node[chunk] = std::max({max_node[chunk], edge.source, edge.target});
+    }, 1);
+    if (std::find(valid.begin(), valid.end(), 0) != valid.end())
+        throw std::runtime_error("malformed line in " + input);
+
+    Node max_id = -1;
+    for (Node id : max_node)
+        max_id = std::max(max_id, id);
+    size_t n_nodes = max_id + 1;
+    size_t n_entries = 0;
+    for (WeightedEdges const &part : edges)
+        n_entries += 2 * part.size();
+
+    // int32 indices as long as the directed edge count fits
+    if (n_entries < size_t(std::numeric_limits<int32_t>::max()) &&
+        n_nodes < size_t(std::numeric_limits<int32_t>::max()))
+        save_edgelist_csr(output, edges_to_csr<int32_t>(n_nodes, edges, pool));
+    else
+        save_edgelist_csr(output, edges_to_csr<int64_t>(n_nodes, edges, pool));
+    return read_csr_header(output);
+}
+
+#define INSTANTIATE_IO(Index)                                                \
+    template CSRGraph<Index> load_csr(std::string const &);                 \
+    template CSRGraph<Index, Unweighted> load_csr(std::string const &);     \
+    template void save_csr(std::string const &, CSRGraph<Index> const &);   \
+    template void save_csr(                                                 \
+        std::string const &, CSRGraph<Index, Unweighted> const &);          \
+    template CSRGraph<Index> edges_to_csr(                                  \
+        size_t, std::vector<WeightedEdges> const &, ThreadPool &);          \
+    template CSRGraph<Index> edges_to_csr(                                  \
+        size_t, Node const *, Node const *, float const *, size_t,          \
+        ThreadPool &);                                                      \
+    template CSRGraph<Index, double> edges_to_csr(                          \
+        size_t, Node const *, Node const *, double const *, size_t,         \
+        ThreadPool &);
+
+INSTANTIATE_IO(int32_t)
+INSTANTIATE_IO(int64_t)
@@ -0,0 +1,96 @@
+#pragma once
+#include <string>
+#include "algorithm.hpp"
+
+// On-disk CSR graph, laid out so that it can be mapped and used in place:
+//
+//   CSRFileHeader   64 bytes
+//   indptr          (n_nodes + 1) x Index
+//   indices         n_edges x Index
+//   weights         n_edges x float, absent if flags has CSR_UNWEIGHTED
+//
+// Index is int32_t or int64_t as given by index_size, every array starts
+// at a multiple of 8 bytes and numbers are in native byte order. As for
+// graphs coming from scipy, every undirected edge is stored in both
+// directions and a self-loop once. Version 1 files have no flags.
+struct CSRFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t index_size;
+    uint64_t n_nodes;
+    uint64_t n_edges;
+    uint64_t flags;
+    uint64_t reserved[3];
+};
+
+// every edge weighs 1 and the file has no weights array
+const uint64_t CSR_UNWEIGHTED = 1;
+
+CSRFileHeader read_csr_header(std::string const &path);
+
+// Maps the file read-only; the graph keeps the mapping alive. EdgeWeight
+// is Unweighted for files with CSR_UNWEIGHTED and float otherwise.
+template <typename Index, typename EdgeWeight = Weight>
+CSRGraph<Index, EdgeWeight> load_csr(std::string const &path);
+
+// Calls f(graph) on the file mapped with its own index and weight types
+template <typename F>
+auto with_csr_file(std::string const &path, F const &f)
+{
+    CSRFileHeader header = read_csr_header(path);
+    bool unweighted = header.flags & CSR_UNWEIGHTED;
+    if (header.index_size == sizeof(int64_t))
+    {
+        if (unweighted)
+            return f(load_csr<int64_t, Unweighted>(path));
+        return f(load_csr<int64_t>(path));
+    }
+    if (unweighted)
+        return f(load_csr<int32_t, Unweighted>(path));
+    return f(load_csr<int32_t>(path));
+}
+
+// EdgeWeight is float or Unweighted, which writes no weights array
+template <typename Index, typename EdgeWeight>
+void save_csr(std::string const &path, CSRGraph<Index, EdgeWeight> const &graph);
+
+struct WeightedEdge
+{
+    Node source;
+    Node target;
+    Weight weight;
+};
+using WeightedEdges = std::vector<WeightedEdge>;
+
+// Symmetric CSR from edge lists that may hold each edge in one or both
+// directions and several times: duplicates are merged by summing their
+// weights, so an edge listed as (u, v) and (v, u) counts twice.
+template <typename Index>
+CSRGraph<Index> edges_to_csr(
+    size_t n_nodes,
+    std::vector<WeightedEdges> const &edges,
+    ThreadPool &pool);
+
+// Same from edge arrays: sources[i] to targets[i], weighing weights[i] or
+// 1 when weights is null. The graph keeps the type of the weights, float
+// or double.
+template <typename Index, typename EdgeWeight>
+CSRGraph<Index, EdgeWeight> edges_to_csr(
+    size_t n_nodes,
+    Node const *sources,
+    Node const *targets,
+    EdgeWeight const *weights,
+    size_t n_edges,
+    ThreadPool &pool);
+
+// Converts a text file of "source target [weight]" lines, separated by
+// spaces, tabs or commas, to the binary format. Node ids are integers in
+// [0, n_nodes), lines starting with '#' or '%' are skipped and a missing
+// weight is 1. When every edge of the result weighs 1, which is not the
+// case if an edge is listed twice, the file is written without weights.
+// Returns the header that was written.
+CSRFileHeader convert_edgelist(
+    std::string const &input,
+    std::string const &output,
+    int n_threads);
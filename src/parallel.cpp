@@ -0,0 +1,69 @@
+#include "parallel.hpp"
+
+ThreadPool::ThreadPool(size_t n_threads)
+    : n_requested(n_threads)
+{
+    // threads beyond the cores would only take turns on them
+    size_t n_cores = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 1; i < std::min(n_threads, n_cores); i++)
+        workers.emplace_back(&ThreadPool::work, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    job_ready.notify_all();
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+void ThreadPool::run(std::function<void(size_t)> const &job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current_job = &job;
+        n_busy = workers.size();
+        generation++;
+    }
+    job_ready.notify_all();
+
+    job(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    job_done.wait(lock, [this]() { return n_busy == 0; });
+    current_job = nullptr;
+}
+
+void ThreadPool::work(size_t thread)
+{
+    size_t seen = 0;
+    while (true)
+    {
+        std::function<void(size_t)> const *job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job_ready.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+            job = current_job;
+        }
+
+        (*job)(thread);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--n_busy == 0)
+            job_done.notify_one();
+    }
+}
+
+// 0 or a negative count means one thread per core
+size_t resolve_n_threads(int n_threads)
+{
+    if (n_threads > 0)
+        return n_threads;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that parallel_for hands index ranges to.
+// The calling thread takes part in the work, so a pool of size 1 spawns
+// nothing and runs everything inline. No more threads than cores are
+// started: size() may be below the count asked for, which is kept in
+// requested() for the callers whose results depend on it.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(size_t n_threads);
+    ~ThreadPool();
+
+    size_t size() const { return workers.size() + 1; }
+    size_t requested() const { return n_requested; }
+
+    // calls fn(i) for every i in [begin, end), in chunks of `grain`
+    // indices that idle threads grab from a shared counter
+    template <typename F>
+    void parallel_for(size_t begin, size_t end, F const &fn, size_t grain = 256)
+    {
+        parallel_for_thread(
+            begin, end, [&](size_t, size_t i) { fn(i); }, grain);
+    }
+
+    // same as parallel_for but calls fn(thread, i), thread being a stable
+    // index in [0, size()) that can be used to pick per-thread buffers
+    template <typename F>
+    void parallel_for_thread(size_t begin, size_t end, F const &fn, size_t grain = 256)
+    {
+        if (end <= begin)
+            return;
+        if (workers.empty() || end - begin <= grain)
+        {
+            for (size_t i = begin; i < end; i++)
+                fn(0, i);
+            return;
+        }
+
+        std::atomic<size_t> next(begin);
+        std::function<void(size_t)> job = [&](size_t thread)
+        {
+            while (true)
+            {
+                size_t start = next.fetch_add(grain);
+                if (start >= end)
+                    break;
+                size_t stop = std::min(start + grain, end);
+                for (size_t i = start; i < stop; i++)
+                    fn(thread, i);
+            }
+        };
+        run(job);
+    }
+
+private:
+    void run(std::function<void(size_t)> const &job);
+    void work(size_t thread);
+
+    size_t n_requested;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable job_ready;
+    std::condition_variable job_done;
+    std::function<void(size_t)> const *current_job = nullptr;
+    size_t generation = 0;
+    size_t n_busy = 0;
+    bool stopping = false;
+};
+
+size_t resolve_n_threads(int n_threads);
@@ -0,0 +1,45 @@
+#include "progress.hpp"
+
+Progress::Progress(ProgressCallback callback)
+    : callback(callback), mark(std::chrono::steady_clock::now())
+{
+}
+
+void Progress::start_level(size_t n_nodes, size_t n_edges)
+{
+    levels.emplace_back();
+    levels.back().n_nodes = n_nodes;
+    levels.back().n_edges = n_edges;
+    mark = std::chrono::steady_clock::now();
+}
+
+void Progress::sweep(size_t n_moved, float modularity)
+{
+    levels.back().moves.push_back(n_moved);
+    levels.back().sweep_modularity.push_back(modularity);
+    report();
+}
+
+void Progress::end_level(
+    size_t n_communities,
+    float modularity,
+    size_t buffer_bytes)
+{
+    levels.back().n_communities = n_communities;
+    levels.back().modularity = modularity;
+    levels.back().buffer_bytes = buffer_bytes;
+    report();
+}
+
+void Progress::add_time(double LevelStats::*phase)
+{
+    auto now = std::chrono::steady_clock::now();
+    levels.back().*phase += std::chrono::duration<double>(now - mark).count();
+    mark = now;
+}
+
+void Progress::report()
+{
+    if (callback && !stop)
+        stop = !callback(levels.size() - 1, levels.back());
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <vector>
+
+// What one level of the dendrogram did. Times are wall clock seconds.
+struct LevelStats
+{
+    size_t n_nodes = 0;
+    size_t n_edges = 0;
+    size_t n_communities = 0;
+    float modularity = 0;
+
+    // nodes moved by each sweep of local moving, and modularity after it
+    std::vector<size_t> moves;
+    std::vector<float> sweep_modularity;
+
+    double init_seconds = 0;
+    double move_seconds = 0;
+    double refine_seconds = 0;
+    double aggregate_seconds = 0;
+
+    // memory held by the level buffers at the end of the level; it peaks
+    // with the first level and is reused by the next ones
+    size_t buffer_bytes = 0;
+};
+
+// Called with the index of the current level and its stats so far.
+// Returning false stops the run.
+using ProgressCallback = std::function<bool(size_t, LevelStats const &)>;
+
+// Stats of every level of a run, one entry per level that was started,
+// including the last one whose result did not improve modularity and was
+// left out of the dendrogram. The callback is invoked after each sweep and
+// at the end of each level, never from the inner loops. Once it asks to
+// stop, local moving returns after the current sweep, the level is
+// completed and no further level is started.
+class Progress
+{
+public:
+    explicit Progress(ProgressCallback callback = nullptr);
+
+    void start_level(size_t n_nodes, size_t n_edges);
+    void sweep(size_t n_moved, float modularity);
+    void end_level(size_t n_communities, float modularity, size_t buffer_bytes);
+
+    // adds the time since the previous mark to `phase` of the current level
+    void add_time(double LevelStats::*phase);
+
+    bool stopped() const { return stop; }
+
+    std::vector<LevelStats> levels;
+
+private:
+    void report();
+
+    ProgressCallback callback;
+    bool stop = false;
+    std::chrono::steady_clock::time_point mark;
+};
@@ -0,0 +1,798 @@
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <pybind11/stl.h>
+#include "pyapi.hpp"
+
+template <typename Index, typename EdgeWeight>
+CSRGraph<Index, EdgeWeight> get_adj(
+    py::array_t<Index> _indptr,
+    py::array_t<Index> _indices,
+    py::object _data)
+{
+    // borrow data buffers, the arrays are kept alive by the graph
+    py::buffer_info indptrBuf = _indptr.request();
+    py::buffer_info indicesBuf = _indices.request();
+
+    CSRGraph<Index, EdgeWeight> graph;
+    graph.n_nodes = indptrBuf.shape[0] - 1;
+    graph.indptr = (Index *)indptrBuf.ptr;
+    graph.indices = (Index *)indicesBuf.ptr;
+    if constexpr (std::is_same_v<EdgeWeight, Unweighted>)
+    {
+        graph.storage = std::make_shared<py::tuple>(
+            py::make_tuple(_indptr, _indices));
+    }
+    else
+    {
+        py::array_t<EdgeWeight> data = _data.cast<py::array_t<EdgeWeight>>();
+        graph.weights = (EdgeWeight *)data.request().ptr;
+        graph.storage = std::make_shared<py::tuple>(
+            py::make_tuple(_indptr, _indices, data));
+    }
+    return graph;
+}
+
+// scipy picks int32 or int64 indices depending on the graph size: run on
+// whichever one we were given so that get_adj never has to copy them
+bool has_int64_indices(py::array const &_indices)
+{
+    return _indices.dtype().is(py::dtype::of<int64_t>());
+}
+
+// Initial community of every node, or an empty vector if every node
+// starts alone
+Nodes get_membership(py::object _membership, size_t n_nodes)
+{
+    Nodes membership;
+    if (_membership.is_none())
+        return membership;
+
+    py::array_t<int64_t> membership_array = _membership.cast<py::array_t<int64_t>>();
+    py::buffer_info membershipBuf = membership_array.request();
+    int64_t *membership_ptr = (int64_t *)membershipBuf.ptr;
+    if (membershipBuf.size != n_nodes)
+        throw std::invalid_argument("membership must have one entry per node");
+
+    membership.assign(membership_ptr, membership_ptr + n_nodes);
+    for (Node com : membership)
+    {
+        if (com < 0 || com >= n_nodes)
+            throw std::out_of_range("membership must be in [0, n_nodes)");
+    }
+    return membership;
+}
+
+// Optional Python callable called as progress(level, stats) after every
+// sweep and level. Returning False stops the run; None or True goes on.
+// The GIL is only taken for the call itself.
+ProgressCallback get_progress_callback(py::object _progress)
+{
+    if (_progress.is_none())
+        return nullptr;
+    return [_progress](size_t level, LevelStats const &stats)
+    {
+        py::gil_scoped_acquire gil;
+        py::object result = _progress(level, stats);
+        return result.is_none() || result.cast<bool>();
+    };
+}
+
+// Hands a vector over to numpy without copying it: the array owns the
+// buffer through a capsule
+template <typename T>
+py::array_t<T> to_numpy(std::vector<T> &&values)
+{
+    auto *owner = new std::vector<T>(std::move(values));
+    py::capsule free_owner(owner, [](void *ptr) { delete (std::vector<T> *)ptr; });
+    return py::array_t<T>(owner->size(), owner->data(), free_owner);
+}
+
+py::list to_numpy(GraphNeighbors &&partition_list)
+{
+    py::list levels;
+    for (Nodes &level : partition_list)
+        levels.append(to_numpy(std::move(level)));
+    return levels;
+}
+
+// The merges of a full dendrogram, as an (n_merges, 2) array
+py::array_t<int64_t> to_numpy(Merges const &merges)
+{
+    py::array_t<int64_t> pairs({py::ssize_t(merges.size()), py::ssize_t(2)});
+    int64_t *pairs_ptr = pairs.mutable_data();
+    for (auto [from, into] : merges)
+    {
+        *pairs_ptr++ = from;
+        *pairs_ptr++ = into;
+    }
+    return pairs;
+}
+
+// A full dendrogram ends with its merges (see check_merges), the only
+// 2-D array it holds
+bool has_merges(py::list _dendrogram)
+{
+    if (_dendrogram.size() == 0)
+        return false;
+    py::handle last = _dendrogram[_dendrogram.size() - 1];
+    return py::isinstance<py::array>(last) && last.cast<py::array>().ndim() == 2;
+}
+
+// The merges at the end of a full dendrogram of which the last level has
+// n_communities communities, checked
+Merges get_merges(py::list _dendrogram, size_t n_communities)
+{
+    auto pairs = _dendrogram[_dendrogram.size() - 1]
+                     .cast<py::array_t<int64_t, py::array::c_style | py::array::forcecast>>();
+    if (pairs.shape(1) != 2)
+        throw std::invalid_argument("the merges must be an (n_merges, 2) array");
+    int64_t const *pairs_ptr = pairs.data();
+    Merges merges(pairs.shape(0));
+    for (auto &[from, into] : merges)
+    {
+        from = *pairs_ptr++;
+        into = *pairs_ptr++;
+    }
+    check_merges(merges, n_communities);
+    return merges;
+}
+
+// Copies a dendrogram given as a sequence of int arrays or lists, and
+// checks that its levels fit together. Only the callers that pass
+// `merges` take a full dendrogram, whose merges are read into it.
+GraphNeighbors get_dendrogram(py::list _dendrogram, Merges *merges = nullptr)
+{
+    bool full = has_merges(_dendrogram);
+    if (full && !merges)
+        throw std::invalid_argument(
+            "the merges of a full dendrogram are only read by "
+            "partition_at_level and score_dendrogram");
+    GraphNeighbors partition_list;
+    for (size_t k = 0; k + full < _dendrogram.size(); k++)
+    {
+        auto level = _dendrogram[k].cast<py::array_t<int64_t, py::array::c_style | py::array::forcecast>>();
+        partition_list.emplace_back(level.data(), level.data() + level.size());
+    }
+    check_dendrogram(partition_list);
+    if (full)
+    {
+        if (partition_list.empty())
+            throw std::invalid_argument("a full dendrogram needs a level");
+        Node n_communities = 0;
+        for (Node com : partition_list.back())
+            n_communities = std::max(n_communities, com + 1);
+        *merges = get_merges(_dendrogram, n_communities);
+    }
+    return partition_list;
+}
+
+// The dendrogram, or a (dendrogram, stats) tuple if the caller asked for
+// the per-level stats
+py::object with_stats(
+    GraphNeighbors &&partition_list,
+    Progress const &progress,
+    bool return_stats)
+{
+    if (return_stats)
+        return py::make_tuple(to_numpy(std::move(partition_list)), progress.levels);
+    return to_numpy(std::move(partition_list));
+}
+
+// Calls f(graph) on the CSR arrays wrapped with the weight type of
+// `_data`: float32 and float64 are used in place, None means every edge
+// weighs 1 and anything else is converted to float32. The sums the runs
+// keep are float32 in every case (see CSRGraph).
+template <typename Index, typename F>
+auto with_weights(
+    py::array _indptr,
+    py::array _indices,
+    py::object _data,
+    F const &f)
+{
+    if (_data.is_none())
+        return f(get_adj<Index, Unweighted>(_indptr, _indices, _data));
+    if (py::isinstance<py::array_t<double>>(_data))
+        return f(get_adj<Index, double>(_indptr, _indices, _data));
+    return f(get_adj<Index, float>(_indptr, _indices, _data));
+}
+
+// Same with whichever index type the arrays use
+template <typename F>
+auto with_graph(
+    py::array _indptr,
+    py::array _indices,
+    py::object _data,
+    F const &f)
+{
+    if (has_int64_indices(_indices))
+        return with_weights<int64_t>(_indptr, _indices, _data, f);
+    return with_weights<int32_t>(_indptr, _indices, _data, f);
+}
+
+// Calls run(graph) without the GIL. The graph is released once the GIL is
+// held again, as it may be the last owner of the numpy arrays.
+template <typename F>
+GraphNeighbors run_without_gil(
+    py::array _indptr,
+    py::array _indices,
+    py::object _data,
+    F const &run)
+{
+    return with_graph(_indptr, _indices, _data, [&](auto const &graph)
+    {
+        py::gil_scoped_release release;
+        return run(graph);
+    });
+}
+
+py::object generate_dendrogram(
+    py::array _indptr,
+    py::array _indices,
+    py::object _data,
+    float resolution,
+    bool prune,
+    int n_threads,
+    std::string const &method,
+    py::object _membership,
+    py::object _progress,
+    bool return_stats,
+    std::string const &order,
+    uint64_t seed,
+    std::string const &checkpoint)
+{
+    if (method != "louvain" && method != "leiden")
+        throw std::invalid_argument("unknown method: " + method);
+
+    size_t n_nodes = _indptr.request().shape[0] - 1;
+    Nodes membership = get_membership(_membership, n_nodes);
+    Progress progress(get_progress_callback(_progress));
+    GraphNeighbors partition_list = run_without_gil(
+        _indptr, _indices, _data, [&](auto const &graph)
+        {
+            return run_in_order(
+                graph, order, seed, membership, n_threads,
+                [&](auto const &ordered, Nodes const &ordered_membership)
+                {
+                    if (method == "leiden")
+                        return leiden_dendrogram(
+                            ordered, resolution, prune, n_threads,
+                            ordered_membership, &progress, checkpoint);
+                    return dendrogram(
+                        ordered, resolution, prune, n_threads,
+                        ordered_membership, &progress, checkpoint);
+                });
+        });
+    return with_stats(std::move(partition_list), progress, return_stats);
+}
+
+py::object generate_consensus(
+    py::array _indptr,
+    py::array _indices,
+    py::object _data,
+    size_t n_runs,
+    uint64_t seed,
+    float resolution,
+    bool prune,
+    int n_threads,
+    std::string const &method,
+    py::object _progress,
+    bool return_stats)
+{
+    if (method != "louvain" && method != "leiden")
+        throw std::invalid_argument("unknown method: " + method);
+    if (n_runs == 0)
+        throw std::invalid_argument("n_runs must be positive");
+
+    Progress progress(get_progress_callback(_progress));
+    GraphNeighbors partition_list = run_without_gil(
+        _indptr, _indices, _data, [&](auto const &graph)
+        {
+            return consensus_dendrogram(
+                graph, n_runs, seed, n_threads, &progress,
+                [&](auto const &run_graph, Nodes const &membership,
+                    int run_threads, Progress *run_progress)
+                {
+                    if (method == "leiden")
+                        return leiden_dendrogram(
+                            run_graph, resolution, prune, run_threads,
+                            membership, run_progress);
+                    return dendrogram(
+                        run_graph, resolution, prune, run_threads,
+                        membership, run_progress);
+                });
+        });
+    return with_stats(std::move(partition_list), progress, return_stats);
+}
+
+py::object update_dendrogram(
+    py::array _indptr,
+    py::array _indices,
+    py::object _data,
+    py::list _previous,
+    py::array_t<int64_t> _changed,
+    float resolution,
+    int n_threads,
+    py::object _progress,
+    bool return_stats)
+{
+    GraphNeighbors previous = get_dendrogram(_previous);
+    py::buffer_info changedBuf = _changed.request();
+    int64_t *changed_ptr = (int64_t *)changedBuf.ptr;
+    size_t n_nodes = _indptr.request().shape[0] - 1;
+    Nodes changed(changed_ptr, changed_ptr + changedBuf.size);
+    for (Node node : changed)
+    {
+        if (node < 0 || node >= n_nodes)
+            throw std::out_of_range("changed node out of range");
+    }
+
+    Progress progress(get_progress_callback(_progress));
+    GraphNeighbors partition_list = run_without_gil(
+        _indptr, _indices, _data, [&](auto const &graph)
+        {
+            return incremental_dendrogram(
+                graph, previous, changed, resolution, n_threads, &progress);
+        });
+    return with_stats(std::move(partition_list), progress, return_stats);
+}
+
+py::object generate_full_dendrogram(
+    py::array _indptr,
+    py::array _indices,
+    py::object _data,
+    float resolution,
+    bool prune,
+    int n_threads,
+    py::object _progress,
+    bool return_stats)
+{
+    Progress progress(get_progress_callback(_progress));
+    Merges merges;
+    GraphNeighbors partition_list = run_without_gil(
+        _indptr, _indices, _data, [&](auto const &graph)
+        {
+            return full_dendrogram(
+                graph, resolution, prune, n_threads, merges, &progress);
+        });
+    py::list levels = to_numpy(std::move(partition_list));
+    levels.append(to_numpy(merges));
+    if (return_stats)
+        return py::make_tuple(levels, progress.levels);
+    return levels;
+}
+
+py::object generate_dendrogram_file(
+    std::string const &path,
+    float resolution,
+    bool prune,
+    int n_threads,
+    std::string const &method,
+    py::object _progress,
+    bool return_stats,
+    std::string const &order,
+    uint64_t seed,
+    std::string const &checkpoint)
+{
+    if (method != "louvain" && method != "leiden")
+        throw std::invalid_argument("unknown method: " + method);
+
+    Progress progress(get_progress_callback(_progress));
+    GraphNeighbors partition_list;
+    {
+        // the mapped graph is not owned by Python, it can go without the GIL
+        py::gil_scoped_release release;
+        partition_list = with_csr_file(path, [&](auto const &graph)
+        {
+            return run_in_order(
+                graph, order, seed, Nodes(), n_threads,
+                [&](auto const &ordered, Nodes const &ordered_membership)
+                {
+                    if (method == "leiden")
+                        return leiden_dendrogram(
+                            ordered, resolution, prune, n_threads,
+                            ordered_membership, &progress, checkpoint);
+                    return dendrogram(
+                        ordered, resolution, prune, n_threads,
+                        ordered_membership, &progress, checkpoint);
+                });
+        });
+    }
+    return with_stats(std::move(partition_list), progress, return_stats);
+}
+
+py::object generate_dendrogram_distributed(
+    std::string const &path,
+    int rank,
+    int n_ranks,
+    std::string const &address,
+    float resolution,
+    bool prune,
+    int n_threads,
+    py::object _progress,
+    bool return_stats)
+{
+    Progress progress(get_progress_callback(_progress));
+    GraphNeighbors partition_list;
+    {
+        py::gil_scoped_release release;
+        Communicator comm(address, rank, n_ranks);
+        partition_list = with_csr_file(path, [&](auto const &graph)
+        {
+            return distributed_dendrogram(
+                graph, resolution, prune, n_threads, comm, &progress);
+        });
+    }
+    return with_stats(std::move(partition_list), progress, return_stats);
+}
+
+py::tuple convert_edgelist_file(
+    std::string const &input,
+    std::string const &output,
+    int n_threads)
+{
+    CSRFileHeader header;
+    {
+        py::gil_scoped_release release;
+        header = convert_edgelist(input, output, n_threads);
+    }
+    return py::make_tuple(header.n_nodes, header.n_edges);
+}
+
+py::tuple edges_to_csr_arrays(
+    py::array_t<int64_t, py::array::c_style | py::array::forcecast> _sources,
+    py::array_t<int64_t, py::array::c_style | py::array::forcecast> _targets,
+    py::object _weights,
+    py::object _n_nodes,
+    int n_threads)
+{
+    size_t n_edges = _sources.size();
+    if (size_t(_targets.size()) != n_edges)
+        throw std::invalid_argument("sources and targets must have the same length");
+    // float64 weights are kept, anything else is converted to float32, as
+    // in with_weights
+    py::array_t<double, py::array::c_style | py::array::forcecast> double_array;
+    py::array_t<Weight, py::array::c_style | py::array::forcecast> weights_array;
+    bool double_weights = py::isinstance<py::array_t<double>>(_weights);
+    size_t n_weights = n_edges;
+    if (double_weights)
+    {
+        double_array = _weights.cast<py::array_t<double, py::array::c_style | py::array::forcecast>>();
+        n_weights = double_array.size();
+    }
+    else if (!_weights.is_none())
+    {
+        weights_array = _weights.cast<py::array_t<Weight, py::array::c_style | py::array::forcecast>>();
+        n_weights = weights_array.size();
+    }
+    if (n_weights != n_edges)
+        throw std::invalid_argument("weights must have one entry per edge");
+    Node const *sources = _sources.data();
+    Node const *targets = _targets.data();
+
+    // the node ids are checked before any of them is used as an index
+    Node min_id = 0;
+    Node max_id = -1;
+    {
+        py::gil_scoped_release release;
+        for (size_t i = 0; i < n_edges; i++)
+        {
+            min_id = std::min({min_id, sources[i], targets[i]});
+            max_id = std::max({max_id, sources[i], targets[i]});
+        }
+    }
+    size_t n_nodes = _n_nodes.is_none() ? max_id + 1 : _n_nodes.cast<size_t>();
+    if (min_id < 0 || max_id >= Node(n_nodes))
+        throw std::out_of_range("node ids must be in [0, n_nodes)");
+
+    auto to_arrays = [&](auto index, auto const *weights)
+    {
+        using Index = decltype(index);
+        using EdgeWeight = std::remove_const_t<std::remove_pointer_t<decltype(weights)>>;
+        std::shared_ptr<CSRStorage<Index, EdgeWeight>> storage;
+        bool unweighted;
+        {
+            py::gil_scoped_release release;
+            ThreadPool pool(resolve_n_threads(n_threads));
+            CSRGraph<Index, EdgeWeight> graph = edges_to_csr<Index>(
+                n_nodes, sources, targets, weights, n_edges, pool);
+            // edges_to_csr builds its graph with make_csr
+            storage = std::static_pointer_cast<CSRStorage<Index, EdgeWeight>>(
+                graph.storage);
+            unweighted = std::all_of(storage->weights.begin(),
+                                     storage->weights.end(),
+                                     [](EdgeWeight weight) { return weight == 1; });
+        }
+        py::object data = py::none();
+        if (!unweighted)
+            data = to_numpy(std::move(storage->weights));
+        return py::make_tuple(to_numpy(std::move(storage->indptr)),
+                              to_numpy(std::move(storage->indices)), data);
+    };
+    // int32 indices as long as the directed edge count fits, as scipy does
+    auto with_index = [&](auto const *weights)
+    {
+        if (2 * n_edges < size_t(std::numeric_limits<int32_t>::max()) &&
+            n_nodes < size_t(std::numeric_limits<int32_t>::max()))
+            return to_arrays(int32_t(), weights);
+        return to_arrays(int64_t(), weights);
+    };
+    if (double_weights)
+        return with_index(double_array.data());
+    return with_index(_weights.is_none() ? nullptr : weights_array.data());
+}
+
+py::list generate_partitions(
+    py::list _graphs,
+    float resolution,
+    bool prune,
+    int n_threads,
+    std::string const &method)
+{
+    if (method != "louvain" && method != "leiden")
+        throw std::invalid_argument("unknown method: " + method);
+
+    // one job per graph, each holding its own view of the arrays
+    std::vector<std::function<Nodes()>> jobs;
+    std::vector<size_t> sizes;
+    for (py::handle item : _graphs)
+    {
+        py::tuple arrays = item.cast<py::tuple>();
+        if (arrays.size() != 3)
+            throw std::invalid_argument("graphs must be (indptr, indices, data) tuples");
+        py::array _indptr = arrays[0].cast<py::array>();
+        py::array _indices = arrays[1].cast<py::array>();
+        py::object _data = arrays[2];
+
+        auto job = [=](auto const &graph)
+        {
+            return std::function<Nodes()>([=]()
+            {
+                if (method == "leiden")
+                    return flatten_dendrogram(leiden_dendrogram(
+                        graph, resolution, prune, 1, Nodes()));
+                return flatten_dendrogram(dendrogram(
+                    graph, resolution, prune, 1, Nodes()));
+            });
+        };
+        jobs.push_back(with_graph(_indptr, _indices, _data, job));
+        sizes.push_back(_indices.size());
+    }
+
+    // largest graphs first, so that the small ones fill in at the end
+    std::vector<size_t> order(jobs.size());
+    for (size_t k = 0; k < order.size(); k++)
+        order[k] = k;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                     { return sizes[a] > sizes[b]; });
+
+    GraphNeighbors partitions(jobs.size());
+    std::vector<std::exception_ptr> errors(jobs.size());
+    {
+        py::gil_scoped_release release;
+        ThreadPool pool(resolve_n_threads(n_threads));
+        pool.parallel_for(0, jobs.size(), [&](size_t k)
+        {
+            size_t job = order[k];
+            try
+            {
+                partitions[job] = jobs[job]();
+            }
+            catch (...)
+            {
+                errors[job] = std::current_exception();
+            }
+        }, 1);
+    }
+    for (std::exception_ptr const &error : errors)
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+    return to_numpy(std::move(partitions));
+}
+
+// Number of resolutions run in a row by generate_multi_resolution, each
+// warm-started from the previous one
+const size_t MULTI_RESOLUTION_CHAIN = 4;
+
+py::tuple generate_multi_resolution(
+    py::array _indptr,
+    py::array _indices,
+    py::object _data,
+    std::vector<float> const &resolutions,
+    bool prune,
+    int n_threads,
+    std::string const &method)
+{
+    if (method != "louvain" && method != "leiden")
+        throw std::invalid_argument("unknown method: " + method);
+
+    // lowest resolution, hence smallest communities, first: every run
+    // starts from the first level of the previous one, whose communities
+    // are small enough to be mostly nested in the next ones. Starting from
+    // the final partition would be faster but can get stuck, as local
+    // moving never splits a community.
+    size_t n_runs = resolutions.size();
+    std::vector<size_t> order(n_runs);
+    for (size_t k = 0; k < n_runs; k++)
+        order[k] = k;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                     { return resolutions[a] < resolutions[b]; });
+
+    // chains of MULTI_RESOLUTION_CHAIN consecutive resolutions, fixed
+    // whatever the number of threads so that the results are too. The
+    // chains are spread over the threads and those left over shared among
+    // the runs; like louvain(), runs take the parallel path unless a
+    // single thread was asked for, even if that oversubscribes the cores.
+    size_t n_total = resolve_n_threads(n_threads);
+    size_t n_chains = (n_runs + MULTI_RESOLUTION_CHAIN - 1) / MULTI_RESOLUTION_CHAIN;
+    size_t n_workers = std::max<size_t>(1, std::min(n_total, n_chains));
+    int run_threads = n_total == 1 ? 1 : std::max<size_t>(2, n_total / n_workers);
+
+    size_t n_nodes = _indptr.request().shape[0] - 1;
+    GraphNeighbors partitions(n_runs);
+    std::vector<double> modularities(n_runs);
+    std::vector<std::exception_ptr> errors(n_runs);
+    with_graph(_indptr, _indices, _data, [&](auto const &graph)
+    {
+        py::gil_scoped_release release;
+        ThreadPool pool(n_workers);
+        pool.parallel_for(0, n_chains, [&](size_t chain)
+        {
+            Nodes membership;
+            for (size_t k = chain * MULTI_RESOLUTION_CHAIN;
+                 k < std::min(n_runs, (chain + 1) * MULTI_RESOLUTION_CHAIN);
+                 k++)
+            {
+                size_t run = order[k];
+                float resolution = resolutions[run];
+                try
+                {
+                    GraphNeighbors partition_list =
+                        method == "leiden"
+                            ? leiden_dendrogram(graph, resolution, prune,
+                                                run_threads, membership)
+                            : dendrogram(graph, resolution, prune,
+                                         run_threads, membership);
+                    partitions[run] = flatten_dendrogram(partition_list);
+                    modularities[run] = partition_modularity(
+                        graph, partitions[run], resolution);
+                    membership = std::move(partition_list[0]);
+                }
+                catch (...)
+                {
+                    errors[run] = std::current_exception();
+                    membership.clear();
+                }
+            }
+        }, 1);
+        return 0;
+    });
+    for (std::exception_ptr const &error : errors)
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    py::array_t<int64_t> result({py::ssize_t(n_runs), py::ssize_t(n_nodes)});
+    int64_t *data = result.mutable_data();
+    for (size_t run = 0; run < n_runs; run++)
+        std::copy(partitions[run].begin(), partitions[run].end(),
+                  data + run * n_nodes);
+    return py::make_tuple(result, py::array_t<double>(n_runs, modularities.data()));
+}
+
+py::tuple score_dendrogram(
+    py::list _dendrogram,
+    py::array_t<double, py::array::c_style | py::array::forcecast> _X,
+    std::string const &scoring,
+    size_t sample_size,
+    uint64_t seed,
+    int n_threads)
+{
+    if (scoring != "silhouette" && scoring != "calinski_harabasz")
+        throw std::invalid_argument("unknown scoring: " + scoring);
+    Merges merges;
+    GraphNeighbors partition_list = get_dendrogram(_dendrogram, &merges);
+    if (partition_list.empty())
+        throw std::invalid_argument("empty dendrogram");
+    size_t n_nodes = partition_list[0].size();
+    if (_X.ndim() != 2 || _X.shape(0) != n_nodes)
+        throw std::invalid_argument("X must have one row per node");
+    size_t dim = _X.shape(1);
+    double const *X = _X.data();
+
+    // by depth, the first level alone being depth 0
+    std::vector<double> depth_scores;
+    {
+        py::gil_scoped_release release;
+        if (scoring == "silhouette")
+            depth_scores = silhouette_scores(
+                partition_list, merges, X, dim,
+                sample_points(n_nodes, sample_size, seed), n_threads);
+        else
+            depth_scores = calinski_harabasz_scores(
+                partition_list, merges, X, dim);
+    }
+
+    size_t n_levels = depth_scores.size();
+    py::array_t<double> scores(n_levels);
+    double *scores_ptr = scores.mutable_data();
+    size_t best_level = 1;
+    for (size_t level = 1; level <= n_levels; level++)
+    {
+        scores_ptr[level - 1] = depth_scores[n_levels - level];
+        if (scores_ptr[level - 1] >= scores_ptr[best_level - 1])
+            best_level = level;
+    }
+    return py::make_tuple(best_level, scores);
+}
+
+py::array_t<int64_t> partition_at_level(py::list _dendrogram, size_t level)
+{
+    // the merges of a full dendrogram count as one level each
+    bool full = has_merges(_dendrogram);
+    size_t n_stored = _dendrogram.size() - full;
+    size_t n_merges = 0;
+    if (full)
+        n_merges = _dendrogram[n_stored].cast<py::array>().shape(0);
+    size_t n_levels = n_stored + n_merges;
+    if (level < 1 || level > n_levels)
+        throw std::out_of_range("level must be in [1, number of levels]");
+    size_t n_used = n_levels - level + 1;
+    size_t n_used_merges = n_used > n_stored ? n_used - n_stored : 0;
+
+    // levels are read in place when they already are contiguous int64
+    std::vector<py::array_t<int64_t, py::array::c_style | py::array::forcecast>> levels;
+    for (size_t k = 0; k < n_used - n_used_merges; k++)
+        levels.push_back(
+            _dendrogram[k].cast<py::array_t<int64_t, py::array::c_style | py::array::forcecast>>());
+
+    size_t n_nodes = levels[0].size();
+    py::array_t<int64_t> partition(n_nodes);
+    int64_t *result = partition.mutable_data();
+    std::copy(levels[0].data(), levels[0].data() + n_nodes, result);
+
+    bool valid = true;
+    {
+        py::gil_scoped_release release;
+        for (size_t k = 1; k < levels.size() && valid; k++)
+        {
+            int64_t const *next = levels[k].data();
+            int64_t size = levels[k].size();
+            for (size_t node = 0; node < n_nodes; node++)
+            {
+                if (result[node] < 0 || result[node] >= size)
+                {
+                    valid = false;
+                    break;
+                }
+                result[node] = next[result[node]];
+            }
+        }
+    }
+    if (!valid)
+        throw std::out_of_range("dendrogram levels do not match");
+
+    if (n_used_merges > 0)
+    {
+        Node n_communities = 0;
+        for (size_t node = 0; node < n_nodes; node++)
+            n_communities = std::max(n_communities, result[node] + 1);
+        Merges merges = get_merges(_dendrogram, n_communities);
+        py::gil_scoped_release release;
+        Nodes merged = merge_partition(merges, n_used_merges, n_communities);
+        for (size_t node = 0; node < n_nodes; node++)
+            result[node] = merged[result[node]];
+    }
+    return partition;
+}
+
+template CSRGraph<int32_t> get_adj(
+    py::array_t<int32_t>, py::array_t<int32_t>, py::object);
+template CSRGraph<int64_t> get_adj(
+    py::array_t<int64_t>, py::array_t<int64_t>, py::object);
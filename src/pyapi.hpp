@@ -0,0 +1,168 @@
+#pragma once
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include "algorithm.hpp"
+#include "consensus.hpp"
+#include "distributed.hpp"
+#include "graph_io.hpp"
+#include "reorder.hpp"
+#include "scoring.hpp"
+
+namespace py = pybind11;
+
+// Graph over the CSR arrays, with `_data` as EdgeWeight weights (ignored
+// for Unweighted graphs)
+template <typename Index, typename EdgeWeight = Weight>
+CSRGraph<Index, EdgeWeight> get_adj(
+    py::array_t<Index> _indptr,
+    py::array_t<Index> _indices,
+    py::object _data);
+
+py::object generate_dendrogram(
+    py::array _indptr,
+    py::array _indices,
+    py::object _data,
+    float resolution,
+    bool prune,
+    int n_threads,
+    std::string const &method,
+    py::object _membership,
+    py::object _progress,
+    bool return_stats,
+    std::string const &order,
+    uint64_t seed,
+    std::string const &checkpoint);
+
+// Consensus of n_runs runs in random node orders (see
+// consensus_dendrogram): the dendrogram of the co-association graph
+py::object generate_consensus(
+    py::array _indptr,
+    py::array _indices,
+    py::object _data,
+    size_t n_runs,
+    uint64_t seed,
+    float resolution,
+    bool prune,
+    int n_threads,
+    std::string const &method,
+    py::object _progress,
+    bool return_stats);
+
+py::object update_dendrogram(
+    py::array _indptr,
+    py::array _indices,
+    py::object _data,
+    py::list _previous,
+    py::array_t<int64_t> _changed,
+    float resolution,
+    int n_threads,
+    py::object _progress,
+    bool return_stats);
+
+// full_dendrogram: its levels followed by its merges as an (n_merges, 2)
+// array, which only partition_at_level and score_dendrogram read
+py::object generate_full_dendrogram(
+    py::array _indptr,
+    py::array _indices,
+    py::object _data,
+    float resolution,
+    bool prune,
+    int n_threads,
+    py::object _progress,
+    bool return_stats);
+
+// Same as generate_dendrogram on a graph file written by
+// convert_edgelist, mapped instead of loaded
+py::object generate_dendrogram_file(
+    std::string const &path,
+    float resolution,
+    bool prune,
+    int n_threads,
+    std::string const &method,
+    py::object _progress,
+    bool return_stats,
+    std::string const &order,
+    uint64_t seed,
+    std::string const &checkpoint);
+
+// One rank of distributed_dendrogram on a graph file written by
+// convert_edgelist. Every rank holds O(n_nodes) memory, as only the edges
+// are split between them. All n_ranks ranks must be started with the same file,
+// address and settings, on this host for a Unix socket address or on any
+// host for tcp://host:port; rank 0 returns the dendrogram (and its stats),
+// the other ranks an empty one.
+py::object generate_dendrogram_distributed(
+    std::string const &path,
+    int rank,
+    int n_ranks,
+    std::string const &address,
+    float resolution,
+    bool prune,
+    int n_threads,
+    py::object _progress,
+    bool return_stats);
+
+// Edge list text file to graph file, returns (n_nodes, n_edges)
+py::tuple convert_edgelist_file(
+    std::string const &input,
+    std::string const &output,
+    int n_threads);
+
+// Symmetric CSR arrays (indptr, indices, data) of the undirected graph
+// with an edge from sources[i] to targets[i] weighing weights[i] (1 if
+// None), on n_nodes nodes (the largest id + 1 if None). As in
+// convert_edgelist, an edge listed several times, in either direction,
+// weighs the sum of its weights. data is None when every edge weighs 1,
+// as csr_arrays passes it, and float64 when weights is, float32 otherwise.
+py::tuple edges_to_csr_arrays(
+    py::array_t<int64_t, py::array::c_style | py::array::forcecast> _sources,
+    py::array_t<int64_t, py::array::c_style | py::array::forcecast> _targets,
+    py::object _weights,
+    py::object _n_nodes,
+    int n_threads);
+
+// Final partition of every graph of a batch, each given as an
+// (indptr, indices, data) tuple. The graphs are clustered concurrently on
+// a pool of n_threads threads, one graph per thread at a time.
+py::list generate_partitions(
+    py::list _graphs,
+    float resolution,
+    bool prune,
+    int n_threads,
+    std::string const &method);
+
+// Final partition of the graph at every resolution, as a
+// (len(resolutions), n_nodes) array, and its modularity at that
+// resolution. The runs share the graph and are spread over n_threads
+// threads. They go in fixed chains of consecutive resolutions from the
+// lowest up, every run but the first of a chain warm-started from the
+// previous one, so the results do not depend on n_threads beyond
+// louvain()'s 1 against more. Warm-started runs can differ from runs
+// at a single resolution.
+py::tuple generate_multi_resolution(
+    py::array _indptr,
+    py::array _indices,
+    py::object _data,
+    std::vector<float> const &resolutions,
+    bool prune,
+    int n_threads,
+    std::string const &method);
+
+// Best level of the dendrogram for a cluster quality score on X, an
+// embedding with one row per node: "silhouette", on sample_size points
+// drawn with `seed` unless sample_size is 0, or "calinski_harabasz".
+// Returns (level, scores), the level as passed to partition_at_level and
+// scores[level - 1] the score of every level; ties go to the finer level.
+py::tuple score_dendrogram(
+    py::list _dendrogram,
+    py::array_t<double, py::array::c_style | py::array::forcecast> _X,
+    std::string const &scoring,
+    size_t sample_size,
+    uint64_t seed,
+    int n_threads);
+
+// Partition of the original nodes after composing the dendrogram up to
+// `level` levels below its top: 1 gives the final partition and the
+// number of levels the first level alone. That is len(dendrogram), except
+// for a full dendrogram, whose merges count as one level each.
+py::array_t<int64_t> partition_at_level(py::list _dendrogram, size_t level);
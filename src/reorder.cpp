@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include "reorder.hpp"
+
+template <typename Index, typename EdgeWeight>
+Nodes degree_order(CSRGraph<Index, EdgeWeight> const &graph)
+{
+    size_t n_nodes = graph.n_nodes;
+    Nodes nodes(n_nodes);
+    for (Node node = 0; node < n_nodes; node++)
+        nodes[node] = node;
+    std::stable_sort(nodes.begin(), nodes.end(), [&](Node a, Node b)
+    {
+        return graph.indptr[a + 1] - graph.indptr[a] >
+               graph.indptr[b + 1] - graph.indptr[b];
+    });
+    return nodes;
+}
+
+// Every connected component is visited breadth first from its node of
+// lowest degree, the neighbors of a node being queued by increasing
+// degree; the visit order is then reversed.
+template <typename Index, typename EdgeWeight>
+Nodes rcm_order(CSRGraph<Index, EdgeWeight> const &graph)
+{
+    size_t n_nodes = graph.n_nodes;
+    auto degree = [&](Node node) { return graph.indptr[node + 1] - graph.indptr[node]; };
+    auto by_degree = [&](Node a, Node b)
+    {
+        return degree(a) < degree(b) || (degree(a) == degree(b) && a < b);
+    };
+
+    Nodes starts(n_nodes);
+    for (Node node = 0; node < n_nodes; node++)
+        starts[node] = node;
+    std::sort(starts.begin(), starts.end(), by_degree);
+
+    Nodes nodes;
+    nodes.reserve(n_nodes);
+    std::vector<bool> visited(n_nodes, false);
+    Nodes neighbors;
+    for (Node start : starts)
+    {
+        if (visited[start])
+            continue;
+        visited[start] = true;
+        nodes.push_back(start);
+        for (size_t head = nodes.size() - 1; head < nodes.size(); head++)
+        {
+            Node node = nodes[head];
+            neighbors.clear();
+            for (Index i = graph.indptr[node]; i < graph.indptr[node + 1]; i++)
+            {
+                Node neighbor = graph.indices[i];
+                if (visited[neighbor])
+                    continue;
+                visited[neighbor] = true;
+                neighbors.push_back(neighbor);
+            }
+            std::sort(neighbors.begin(), neighbors.end(), by_degree);
+            nodes.insert(nodes.end(), neighbors.begin(), neighbors.end());
+        }
+    }
+    std::reverse(nodes.begin(), nodes.end());
+    return nodes;
+}
+
+Nodes random_order(size_t n_nodes, uint64_t seed)
+{
+    Nodes nodes(n_nodes);
+    for (Node node = 0; node < n_nodes; node++)
+        nodes[node] = node;
+    std::mt19937_64 rng(seed);
+    std::shuffle(nodes.begin(), nodes.end(), rng);
+    return nodes;
+}
+
+template <typename Index, typename EdgeWeight>
+Nodes node_order(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    std::string const &order,
+    uint64_t seed)
+{
+    Nodes nodes;
+    if (order == "degree")
+        nodes = degree_order(graph);
+    else if (order == "rcm")
+        nodes = rcm_order(graph);
+    else if (order == "random")
+        nodes = random_order(graph.n_nodes, seed);
+    else
+        throw std::invalid_argument("unknown node order: " + order);
+
+    Nodes rank(graph.n_nodes);
+    for (size_t k = 0; k < nodes.size(); k++)
+        rank[nodes[k]] = k;
+    return rank;
+}
+
+template <typename Index, typename EdgeWeight>
+CSRGraph<Index, EdgeWeight> permute_graph(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes const &rank,
+    ThreadPool &pool)
+{
+    size_t n_nodes = graph.n_nodes;
+    Nodes nodes(n_nodes);
+    for (Node node = 0; node < n_nodes; node++)
+        nodes[rank[node]] = node;
+
+    std::vector<Index> indptr(n_nodes + 1, 0);
+    for (size_t k = 0; k < n_nodes; k++)
+        indptr[k + 1] = indptr[k] + graph.indptr[nodes[k] + 1] - graph.indptr[nodes[k]];
+
+    std::vector<Index> indices(indptr[n_nodes]);
+    std::vector<EdgeWeight> weights;
+    if constexpr (!std::is_same_v<EdgeWeight, Unweighted>)
+        weights.resize(indptr[n_nodes]);
+    using Entry = std::pair<Index, decltype(graph.weight(0))>;
+    std::vector<std::vector<Entry>> thread_row(pool.size());
+    pool.parallel_for_thread(0, n_nodes, [&](size_t thread, size_t k)
+    {
+        std::vector<Entry> &row = thread_row[thread];
+        row.clear();
+        Node node = nodes[k];
+        for (Index i = graph.indptr[node]; i < graph.indptr[node + 1]; i++)
+            row.emplace_back(rank[graph.indices[i]], graph.weight(i));
+        std::sort(row.begin(), row.end());
+        for (size_t i = 0; i < row.size(); i++)
+        {
+            indices[indptr[k] + i] = row[i].first;
+            if constexpr (!std::is_same_v<EdgeWeight, Unweighted>)
+                weights[indptr[k] + i] = row[i].second;
+        }
+    });
+
+    return make_csr(std::move(indptr), std::move(indices), std::move(weights));
+}
+
+#define INSTANTIATE_REORDER(Index, EdgeWeight)                              \
+    template Nodes node_order(                                              \
+        CSRGraph<Index, EdgeWeight> const &, std::string const &,           \
+        uint64_t);                                                          \
+    template CSRGraph<Index, EdgeWeight> permute_graph(                     \
+        CSRGraph<Index, EdgeWeight> const &, Nodes const &, ThreadPool &);
+
+#define INSTANTIATE_INDEX(Index)                                            \
+    INSTANTIATE_REORDER(Index, float)                                       \
+    INSTANTIATE_REORDER(Index, double)                                      \
+    INSTANTIATE_REORDER(Index, Unweighted)
+
+INSTANTIATE_INDEX(int32_t)
+INSTANTIATE_INDEX(int64_t)
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "algorithm.hpp"
+
+// New id of every node for a locality-friendly order of the graph:
+//   "degree"  by decreasing degree, so that the hubs share cache lines
+//   "rcm"     reverse Cuthill-McKee, a BFS that keeps neighbors close
+// or for a random one, to see how much the result depends on the order:
+//   "random"  uniformly shuffled, the same for a given seed
+template <typename Index, typename EdgeWeight>
+Nodes node_order(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    std::string const &order,
+    uint64_t seed = 0);
+
+// Graph relabeled by `rank`, with every row sorted by new neighbor id
+template <typename Index, typename EdgeWeight>
+CSRGraph<Index, EdgeWeight> permute_graph(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    Nodes const &rank,
+    ThreadPool &pool);
+
+// Calls run(graph, membership) on the graph relabeled by `order` ("none"
+// to keep it as is) and maps the first level of the dendrogram it returns
+// back to the original ids. The other levels need no mapping, as only the
+// first one refers to nodes. The coarse graphs mostly inherit the order:
+// communities start as singletons named after their node, and renumber
+// keeps the order of their ids.
+template <typename Index, typename EdgeWeight, typename F>
+GraphNeighbors run_in_order(
+    CSRGraph<Index, EdgeWeight> const &graph,
+    std::string const &order,
+    uint64_t seed,
+    Nodes const &membership,
+    int n_threads,
+    F const &run)
+{
+    if (order == "none")
+        return run(graph, membership);
+
+    size_t n_nodes = graph.n_nodes;
+    Nodes rank = node_order(graph, order, seed);
+    CSRGraph<Index, EdgeWeight> permuted;
+    {
+        ThreadPool pool(resolve_n_threads(n_threads));
+        permuted = permute_graph(graph, rank, pool);
+    }
+
+    Nodes permuted_membership;
+    if (!membership.empty())
+    {
+        permuted_membership.resize(n_nodes);
+        for (Node node = 0; node < n_nodes; node++)
+            permuted_membership[rank[node]] = membership[node];
+    }
+
+    GraphNeighbors partition_list = run(permuted, permuted_membership);
+    Nodes first_level(n_nodes);
+    for (Node node = 0; node < n_nodes; node++)
+        first_level[node] = partition_list[0][rank[node]];
+    partition_list[0] = std::move(first_level);
+    return partition_list;
+}
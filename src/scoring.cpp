@@ -0,0 +1,423 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include "scoring.hpp"
+
+// memory for the sums of distances from every point to every cluster
+const size_t SILHOUETTE_TABLE_BYTES = size_t(1) << 30;
+
+const double UNDEFINED_SCORE = -std::numeric_limits<double>::infinity();
+
+Nodes sample_points(size_t n_points, size_t sample_size, uint64_t seed)
+{
+    Nodes points(n_points);
+    for (Node point = 0; point < n_points; point++)
+        points[point] = point;
+    if (sample_size == 0 || sample_size >= n_points)
+        return points;
+
+    std::mt19937_64 rng(seed);
+    std::shuffle(points.begin(), points.end(), rng);
+    points.resize(sample_size);
+    std::sort(points.begin(), points.end());
+    return points;
+}
+
+// Number of clusters at every depth, after checking that the levels and
+// the merges compose
+std::vector<size_t> depth_sizes(
+    GraphNeighbors const &partition_list,
+    Merges const &merges)
+{
+    if (partition_list.empty())
+        throw std::invalid_argument("empty dendrogram");
+
+    std::vector<size_t> sizes;
+    for (size_t k = 0; k < partition_list.size(); k++)
+    {
+        size_t size = 0;
+        if (k + 1 < partition_list.size())
+            size = partition_list[k + 1].size();
+        else
+        {
+            for (Node com : partition_list[k])
+                size = std::max(size, size_t(com + 1));
+        }
+        for (Node com : partition_list[k])
+        {
+            if (com < 0 || com >= size)
+                throw std::out_of_range("dendrogram levels do not match");
+        }
+        sizes.push_back(size);
+    }
+    check_merges(merges, sizes.back());
+    for (size_t k = 0; k < merges.size(); k++)
+        sizes.push_back(sizes.back() - 1);
+    return sizes;
+}
+
+// Takes slot_of, the slot of every cluster of a depth, to the next depth,
+// whose clusters keep the slot of their first part. Returns the merges as
+// (slot merged away, slot it was merged into) pairs.
+std::vector<std::pair<Node, Node>> merge_slots(
+    Nodes &slot_of,
+    Nodes const &next,
+    size_t next_size)
+{
+    Nodes next_slot(next_size, -1);
+    std::vector<std::pair<Node, Node>> merges;
+    for (Node com = 0; com < slot_of.size(); com++)
+    {
+        Node &slot = next_slot[next[com]];
+        if (slot < 0)
+            slot = slot_of[com];
+        else
+            merges.emplace_back(slot_of[com], slot);
+    }
+    slot_of.swap(next_slot);
+    return merges;
+}
+
+// Same as merge_slots from depth k - 1 to depth k of the levels followed
+// by the merges. The clusters of the merge tail keep their names, so from
+// the last level on slot_of is indexed by name and does not change.
+std::vector<std::pair<Node, Node>> depth_slots(
+    Nodes &slot_of,
+    GraphNeighbors const &partition_list,
+    Merges const &merges,
+    std::vector<size_t> const &n_clusters,
+    size_t k)
+{
+    size_t n_levels = partition_list.size();
+    if (k < n_levels)
+        return merge_slots(slot_of, partition_list[k], n_clusters[k]);
+    auto [from, into] = merges[k - n_levels];
+    return {{slot_of[from], slot_of[into]}};
+}
+
+// Drops the clusters left empty by merges from the list of clusters
+void drop_empty(Nodes &clusters, std::vector<size_t> const &sizes)
+{
+    clusters.erase(std::remove_if(clusters.begin(), clusters.end(),
+                                  [&](Node c) { return sizes[c] == 0; }),
+                   clusters.end());
+}
+
+// Silhouette of a point from the sums of its distances to every cluster:
+// `a` is its mean distance to the rest of its own cluster and `b` the
+// smallest mean distance to another cluster, which is stored in `best`.
+template <typename Sum>
+double point_silhouette(
+    Sum const *sums,
+    std::vector<size_t> const &sizes,
+    Nodes const &clusters,
+    Node own,
+    Node &best)
+{
+    double b = std::numeric_limits<double>::infinity();
+    best = -1;
+    for (Node c : clusters)
+    {
+        if (c == own)
+            continue;
+        double mean = double(sums[c]) / sizes[c];
+        if (mean < b)
+        {
+            b = mean;
+            best = c;
+        }
+    }
+    if (sizes[own] <= 1 || best < 0)
+        return 0;
+
+    double a = double(sums[own]) / (sizes[own] - 1);
+    double scale = std::max(a, b);
+    return scale > 0 ? (b - a) / scale : 0;
+}
+
+std::vector<double> silhouette_scores(
+    GraphNeighbors const &partition_list,
+    Merges const &merges,
+    double const *X,
+    size_t dim,
+    Nodes const &points,
+    int n_threads)
+{
+    std::vector<size_t> n_clusters = depth_sizes(partition_list, merges);
+    size_t n_levels = partition_list.size();
+    size_t n_names = n_clusters[n_levels - 1];
+    size_t n_depths = n_clusters.size();
+    size_t n_points = points.size();
+    std::vector<double> scores(n_depths, UNDEFINED_SCORE);
+    auto mean_score = [&](std::vector<double> const &values,
+                          size_t n_nonempty)
+    {
+        if (n_nonempty < 2 || n_nonempty >= n_points)
+            return UNDEFINED_SCORE;
+        double total = 0;
+        for (double value : values)
+            total += value;
+        return total / n_points;
+    };
+
+    // depths before table_depth have too many clusters to keep their sums
+    size_t table_depth = 0;
+    while (table_depth < n_depths &&
+           n_points * n_clusters[table_depth] * sizeof(float) >
+               SILHOUETTE_TABLE_BYTES)
+        table_depth++;
+    size_t table_width = table_depth < n_depths ? n_clusters[table_depth] : 0;
+
+    // cluster of every point, the size and the nonempty clusters of every
+    // depth up to the table one
+    size_t n_labeled = std::min(table_depth + 1, n_depths);
+    std::vector<Nodes> labels(n_labeled, Nodes(n_points));
+    std::vector<std::vector<size_t>> sizes(n_labeled);
+    std::vector<Nodes> clusters(n_labeled);
+    for (size_t k = 0; k < n_labeled; k++)
+    {
+        // the merge tail is labeled from the last level
+        Nodes tail;
+        if (k >= n_levels)
+            tail = merge_partition(merges, k - n_levels + 1, n_names);
+        sizes[k].assign(n_clusters[k], 0);
+        for (size_t i = 0; i < n_points; i++)
+        {
+            if (k < n_levels)
+            {
+                Node below = k == 0 ? points[i] : labels[k - 1][i];
+                labels[k][i] = partition_list[k][below];
+            }
+            else
+                labels[k][i] = tail[labels[n_levels - 1][i]];
+            sizes[k][labels[k][i]]++;
+        }
+        for (Node c = 0; c < n_clusters[k]; c++)
+        {
+            if (sizes[k][c] > 0)
+                clusters[k].push_back(c);
+        }
+    }
+
+    ThreadPool pool(resolve_n_threads(n_threads));
+    std::vector<double> direct(n_points * table_depth);
+    std::vector<float> table(n_points * table_width);
+    std::vector<std::vector<double>> distances(pool.size());
+    std::vector<std::vector<double>> sums(pool.size());
+    pool.parallel_for_thread(0, n_points, [&](size_t thread, size_t i)
+    {
+        std::vector<double> &distance = distances[thread];
+        distance.resize(n_points);
+        double const *x = X + points[i] * dim;
+        for (size_t j = 0; j < n_points; j++)
+        {
+            double const *y = X + points[j] * dim;
+            double squared = 0;
+            for (size_t d = 0; d < dim; d++)
+                squared += (x[d] - y[d]) * (x[d] - y[d]);
+            distance[j] = std::sqrt(squared);
+        }
+
+        std::vector<double> &sum = sums[thread];
+        for (size_t k = 0; k < n_labeled; k++)
+        {
+            Nodes const &label = labels[k];
+            sum.assign(n_clusters[k], 0);
+            for (size_t j = 0; j < n_points; j++)
+                sum[label[j]] += distance[j];
+            if (k < table_depth)
+            {
+                Node best;
+                direct[k * n_points + i] = point_silhouette(
+                    sum.data(), sizes[k], clusters[k], label[i], best);
+            }
+            else
+                std::copy(sum.begin(), sum.end(),
+                          table.begin() + i * table_width);
+        }
+    }, 16);
+
+    for (size_t k = 0; k < table_depth; k++)
+    {
+        std::vector<double> values(direct.begin() + k * n_points,
+                                   direct.begin() + (k + 1) * n_points);
+        scores[k] = mean_score(values, clusters[k].size());
+    }
+    if (table_depth == n_depths)
+        return scores;
+
+    // from here on the clusters are slots of the table, and each point
+    // keeps its own slot, its closest other one and its silhouette. In
+    // the merge tail, slot_of is indexed by name (see depth_slots).
+    Nodes slot_of(table_width);
+    Nodes merged_into(table_width);
+    for (Node slot = 0; slot < table_width; slot++)
+    {
+        slot_of[slot] = slot;
+        merged_into[slot] = slot;
+    }
+    if (table_depth >= n_levels)
+        slot_of = merge_partition(merges, table_depth - n_levels + 1, n_names);
+    std::vector<size_t> &slot_sizes = sizes[table_depth];
+    Nodes &slots = clusters[table_depth];
+    Nodes &own = labels[table_depth];
+    Nodes best(n_points);
+    std::vector<double> values(n_points);
+    auto rescore = [&](size_t i)
+    {
+        values[i] = point_silhouette(
+            table.data() + i * table_width, slot_sizes, slots, own[i],
+            best[i]);
+    };
+    pool.parallel_for(0, n_points, rescore);
+    scores[table_depth] = mean_score(values, slots.size());
+
+    std::vector<char> changed(table_width, 0);
+    for (size_t k = table_depth + 1; k < n_depths; k++)
+    {
+        std::vector<std::pair<Node, Node>> slot_merges =
+            depth_slots(slot_of, partition_list, merges, n_clusters, k);
+        for (auto [from, into] : slot_merges)
+        {
+            changed[from] = changed[into] = 1;
+            merged_into[from] = into;
+            // with sampling, a cluster may start out without any point
+            if (slot_sizes[into] == 0 && slot_sizes[from] > 0)
+                slots.push_back(into);
+            slot_sizes[into] += slot_sizes[from];
+            slot_sizes[from] = 0;
+        }
+        drop_empty(slots, slot_sizes);
+
+        // a merged cluster is no closer than the closest of its parts, so
+        // the other points keep both their a and their b
+        pool.parallel_for(0, n_points, [&](size_t i)
+        {
+            float *row = table.data() + i * table_width;
+            for (auto [from, into] : slot_merges)
+                row[into] += row[from];
+            bool affected =
+                changed[own[i]] || (best[i] >= 0 && changed[best[i]]);
+            own[i] = merged_into[own[i]];
+            if (affected)
+                rescore(i);
+        });
+        scores[k] = mean_score(values, slots.size());
+
+        for (auto [from, into] : slot_merges)
+            changed[from] = changed[into] = 0;
+    }
+    return scores;
+}
+
+std::vector<double> calinski_harabasz_scores(
+    GraphNeighbors const &partition_list,
+    Merges const &merges,
+    double const *X,
+    size_t dim)
+{
+    std::vector<size_t> n_clusters = depth_sizes(partition_list, merges);
+    size_t n_depths = n_clusters.size();
+    size_t n_points = partition_list[0].size();
+    size_t width = n_clusters[0];
+
+    // size, mean and within-cluster dispersion of the first depth
+    std::vector<double> center(dim, 0);
+    std::vector<size_t> sizes(width, 0);
+    std::vector<double> means(width * dim, 0);
+    std::vector<double> within(width, 0);
+    for (Node point = 0; point < n_points; point++)
+    {
+        Node c = partition_list[0][point];
+        sizes[c]++;
+        for (size_t d = 0; d < dim; d++)
+        {
+            center[d] += X[point * dim + d];
+            means[c * dim + d] += X[point * dim + d];
+        }
+    }
+    for (size_t d = 0; d < dim; d++)
+        center[d] /= n_points;
+    Nodes clusters;
+    for (Node c = 0; c < width; c++)
+    {
+        if (sizes[c] == 0)
+            continue;
+        clusters.push_back(c);
+        for (size_t d = 0; d < dim; d++)
+            means[c * dim + d] /= sizes[c];
+    }
+    for (Node point = 0; point < n_points; point++)
+    {
+        Node c = partition_list[0][point];
+        for (size_t d = 0; d < dim; d++)
+        {
+            double diff = X[point * dim + d] - means[c * dim + d];
+            within[c] += diff * diff;
+        }
+    }
+
+    auto squared_distance = [&](double const *a, double const *b)
+    {
+        double squared = 0;
+        for (size_t d = 0; d < dim; d++)
+            squared += (a[d] - b[d]) * (a[d] - b[d]);
+        return squared;
+    };
+    std::vector<double> between(width, 0);
+    for (Node c : clusters)
+        between[c] = sizes[c] * squared_distance(&means[c * dim], center.data());
+
+    std::vector<double> scores(n_depths, UNDEFINED_SCORE);
+    Nodes slot_of(width);
+    for (Node slot = 0; slot < width; slot++)
+        slot_of[slot] = slot;
+    for (size_t k = 0; k < n_depths; k++)
+    {
+        if (k > 0)
+        {
+            // Ward's update: the dispersion of a union is that of its
+            // parts plus the spread of their means
+            for (auto [from, into] :
+                 depth_slots(slot_of, partition_list, merges, n_clusters, k))
+            {
+                double *from_mean = &means[from * dim];
+                double *into_mean = &means[into * dim];
+                double n_from = sizes[from];
+                double n_into = sizes[into];
+                double n_total = n_from + n_into;
+                within[into] += within[from] +
+                                n_from * n_into / n_total *
+                                    squared_distance(from_mean, into_mean);
+                for (size_t d = 0; d < dim; d++)
+                    into_mean[d] =
+                        (n_from * from_mean[d] + n_into * into_mean[d]) /
+                        n_total;
+                sizes[into] += sizes[from];
+                sizes[from] = 0;
+                between[into] =
+                    n_total * squared_distance(into_mean, center.data());
+            }
+            drop_empty(clusters, sizes);
+        }
+
+        size_t n_nonempty = clusters.size();
+        if (n_nonempty < 2 || n_nonempty >= n_points)
+            continue;
+        double between_total = 0;
+        double within_total = 0;
+        for (Node c : clusters)
+        {
+            between_total += between[c];
+            within_total += within[c];
+        }
+        scores[k] = within_total == 0
+                        ? 1
+                        : between_total * (n_points - n_nonempty) /
+                              (within_total * (n_nonempty - 1));
+    }
+    return scores;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include "algorithm.hpp"
+
+// Cluster quality of every depth of a dendrogram on an embedding of its
+// nodes. `X` holds one row of `dim` doubles per node, row-major, and
+// scores[k] is the score of the partition given by the first k + 1
+// levels, the merges of a full dendrogram (see check_merges) counting as
+// one level each after those of partition_list. As in scikit-learn, a
+// score is only defined for 2 to n - 1 clusters and is -infinity
+// otherwise. The levels are nested, so both scores are carried from one
+// depth to the next and only the merged clusters are recomputed.
+
+// Sorted random subset of sample_size of the n_points nodes, the same
+// for a given seed, or all of them when sample_size is 0 or too large
+Nodes sample_points(size_t n_points, size_t sample_size, uint64_t seed);
+
+// Mean euclidean silhouette of `points` (see sample_points), computed
+// among these points only. Distances are computed once, in parallel, into
+// the sum of the distances from every point to every cluster of the
+// first depth with at most SILHOUETTE_TABLE_BYTES of such sums; the
+// earlier depths are scored directly in the same pass. From there, a
+// merge adds up the sums of the merged clusters, and only the points in
+// or closest to a merged cluster are rescored.
+std::vector<double> silhouette_scores(
+    GraphNeighbors const &partition_list,
+    Merges const &merges,
+    double const *X,
+    size_t dim,
+    Nodes const &points,
+    int n_threads);
+
+// Calinski-Harabasz index of all the nodes: between-cluster over
+// within-cluster dispersion, each divided by its degrees of freedom. The
+// dispersions of merged clusters follow from their sizes and means.
+std::vector<double> calinski_harabasz_scores(
+    GraphNeighbors const &partition_list,
+    Merges const &merges,
+    double const *X,
+    size_t dim);
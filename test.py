@@ -1,6 +1,16 @@
+import os
+import socket
+import tempfile
+
 import networkx as nx
 import numpy as np
-from louvaincpp import louvain
+from scipy import sparse
+from sklearn.metrics import calinski_harabasz_score, silhouette_score
+from louvaincpp import (convert_edgelist, edges_to_csr, louvain,
+                        louvain_distributed, louvain_edges, louvain_file,
+                        update_louvain)
+from louvaincpp.algorithm import (generate_full_dendrogram, graph_arrays,
+                                  partition_at_level, score_dendrogram)
 
 G = nx.karate_club_graph()
 pos = nx.spectral_layout(G)
@@ -9,3 +19,114 @@ X = np.array([pos[node] for node in G.nodes])
 y = louvain(G)
 print(y)
 
+
+# a dendrogram that does not fit the graph is refused, not read out of
+# bounds
+for dendrogram in ([np.arange(100)], [np.ones(34, dtype=int), [0]]):
+    try:
+        update_louvain(G, dendrogram, [])
+    except ValueError:
+        pass
+    else:
+        raise AssertionError("invalid dendrogram accepted")
+
+# graph files round-trip, with an odd and an even number of directed
+# edges, weighted or not
+karate = list(nx.karate_club_graph().edges)
+for edges in ([(0, 1), (1, 2), (2, 2)], [(0, 1), (1, 2)],
+              [(0, 1, 2.5), (1, 2, 1), (2, 2, 1)], karate, karate + [(5, 5)]):
+    H = nx.Graph()
+    H.add_nodes_from(range(1 + max(max(edge[:2]) for edge in edges)))
+    H.add_weighted_edges_from([(*edge[:2], edge[2] if len(edge) > 2 else 1)
+                               for edge in edges])
+    with tempfile.TemporaryDirectory() as directory:
+        text = os.path.join(directory, "edges.txt")
+        binary = os.path.join(directory, "graph.bin")
+        with open(text, "w") as file:
+            file.writelines(" ".join(map(str, edge)) + "\n" for edge in edges)
+        n_nodes, n_edges = convert_edgelist(text, binary)
+        assert (n_nodes, n_edges) == (H.number_of_nodes(),
+                                      nx.adjacency_matrix(H).nnz)
+        assert np.array_equal(louvain_file(binary), louvain(H, as_array=True))
+
+# a sparse matrix must be a symmetric adjacency; explicit zeros are not
+# edges
+A = nx.adjacency_matrix(G).tocoo()
+try:
+    louvain(sparse.triu(A))
+except ValueError:
+    pass
+else:
+    raise AssertionError("upper-triangular matrix accepted")
+Z = sparse.coo_matrix((np.r_[A.data, 0, 0],
+                       (np.r_[A.row, 0, 33], np.r_[A.col, 33, 0])),
+                      shape=A.shape)
+assert np.array_equal(louvain(Z, as_array=True), louvain(A, as_array=True))
+
+# an edge list keeps float64 weights as a sparse matrix does
+W = sparse.triu(A).tocoo()
+W.data = 1 + np.arange(W.nnz) / 3
+assert edges_to_csr(W.row, W.col, W.data)[2].dtype == np.float64
+assert np.array_equal(louvain_edges(W.row, W.col, W.data),
+                      louvain(W + W.T, as_array=True))
+
+# a run stopped at a level boundary or in the middle of a level resumes
+# from its checkpoint to the same result as an uninterrupted run
+P = nx.powerlaw_cluster_graph(2000, 4, 0.1, seed=1)
+for method in ("louvain", "leiden"):
+    expected = louvain(P, method=method, as_array=True)
+    for stop_at_end in (True, False):
+        with tempfile.TemporaryDirectory() as directory:
+            path = os.path.join(directory, "run.ckpt")
+            louvain(P, method=method, checkpoint=path,
+                    progress=lambda level, stats: not (
+                        level == 1 and (stats.n_communities > 0) == stop_at_end))
+            resumed = louvain(P, method=method, checkpoint=path, as_array=True)
+            assert np.array_equal(resumed, expected)
+            assert not os.path.exists(path)
+
+
+def modularity(graph, partition):
+    return nx.community.modularity(
+        graph, [np.flatnonzero(partition == com) for com in np.unique(partition)])
+
+
+# two ranks, over a Unix socket or TCP, find the same partition, about as
+# good as the serial one
+with tempfile.TemporaryDirectory() as directory:
+    text = os.path.join(directory, "edges.txt")
+    binary = os.path.join(directory, "graph.bin")
+    nx.write_edgelist(P, text, data=False)
+    convert_edgelist(text, binary)
+    with socket.socket() as probe:
+        probe.bind(("127.0.0.1", 0))
+        port = probe.getsockname()[1]
+    serial = louvain_file(binary)
+    distributed = louvain_distributed(binary, n_processes=2)
+    assert np.array_equal(
+        louvain_distributed(binary, n_processes=2,
+                            address="tcp://127.0.0.1:%d" % port),
+        distributed)
+    assert modularity(P, distributed) > modularity(P, serial) - 0.01
+
+# every Leiden community induces a connected subgraph
+for graph in (G, P):
+    partition = louvain(graph, method="leiden", as_array=True)
+    nodes = np.array(graph.nodes)
+    for com in np.unique(partition):
+        assert nx.is_connected(graph.subgraph(nodes[partition == com]))
+
+# the native scores of every level match scikit-learn's, and are -inf
+# where scikit-learn's are undefined. The merges at the end of a full
+# dendrogram count as one level each, down to one community.
+dendrogram = generate_full_dendrogram(*graph_arrays(G))
+assert len(np.unique(partition_at_level(dendrogram, 1))) == 1
+for scoring, score in (("silhouette", silhouette_score),
+                       ("calinski_harabasz", calinski_harabasz_score)):
+    _, scores = score_dendrogram(dendrogram, X, scoring)
+    for level in range(1, len(scores) + 1):
+        partition = partition_at_level(dendrogram, level)
+        if 2 <= len(np.unique(partition)) < len(partition):
+            assert np.isclose(scores[level - 1], score(X, partition), rtol=1e-6)
+        else:
+            assert scores[level - 1] == -np.inf